@@ -8,6 +8,17 @@
 # include "boost/ratio/ratio.hpp"
 //using namespace boost::gregorian;
 # include <string>
+# include <bitset>
+# include <chrono>
+# include <stdexcept>
+# include <cmath>
+# include <thread>
+# include <atomic>
+# include <random>
+# include <memory>
+# include <limits>
+# include <sstream>
+# include <type_traits>
 using namespace boost;
 
 
@@ -22,6 +33,156 @@ need to move the object to a certain position, unless the class has a movable co
 // Create a class that can perform common time-series transformations
 // Time series data filtering is the task of identifying and removing values, both for short term and long term trends, in a sequence of data points
 
+// Lazy transform pipelines
+// calling reducePrices, then increasePrices, then removePricesLessThan walks the whole series once per call
+// a pipeline only records the operations, and running it applies all of them to each value in a single pass
+// consecutive maps are folded into one multiply-add (x -> a x + b) as they are recorded, and consecutive filters into one
+// [low, high] range, so the pass does a few flops and compares per value whatever the length of the recorded chain
+// filtered values are dropped by compaction in place: every value is written to the next free slot and the slot only
+// advances if the value is kept, so there is no branch to mispredict and no second vector
+
+class TimeSeriesPipeline
+{
+public:
+	TimeSeriesPipeline& add(double val);
+	TimeSeriesPipeline& multiply(double val);
+	TimeSeriesPipeline& removeLessThan(double val);
+	TimeSeriesPipeline& removeGreaterThan(double val);
+
+	std::size_t run(double* values, std::size_t n) const;  // returns how many values were kept, at the front of values
+	void run(std::vector<double>& values, unsigned numThreads = 1) const;
+	std::size_t runStream(std::istream& in, std::ostream& out, std::size_t chunkSize = 1 << 16) const;  // binary doubles
+
+private:
+	struct Stage
+	{
+		double scale = 1;
+		double shift = 0;
+		double low = -std::numeric_limits<double>::infinity();
+		double high = std::numeric_limits<double>::infinity();
+		bool filters = false;
+	};
+	std::vector<Stage> m_stages;
+
+	Stage& mapStage();
+};
+
+TimeSeriesPipeline::Stage& TimeSeriesPipeline::mapStage()
+{
+	// a map after a filter has to start a new stage, the filter must see the values before the map
+	if (m_stages.empty() || m_stages.back().filters) m_stages.emplace_back();
+	return m_stages.back();
+}
+
+TimeSeriesPipeline& TimeSeriesPipeline::add(double val)
+{
+	mapStage().shift += val;
+	return *this;
+}
+
+TimeSeriesPipeline& TimeSeriesPipeline::multiply(double val)
+{
+	Stage& stage = mapStage();
+	stage.scale *= val;
+	stage.shift *= val;
+	return *this;
+}
+
+TimeSeriesPipeline& TimeSeriesPipeline::removeLessThan(double val)
+{
+	if (m_stages.empty()) m_stages.emplace_back();
+	m_stages.back().low = std::max(m_stages.back().low, val);
+	m_stages.back().filters = true;
+	return *this;
+}
+
+TimeSeriesPipeline& TimeSeriesPipeline::removeGreaterThan(double val)
+{
+	if (m_stages.empty()) m_stages.emplace_back();
+	m_stages.back().high = std::min(m_stages.back().high, val);
+	m_stages.back().filters = true;
+	return *this;
+}
+
+std::size_t TimeSeriesPipeline::run(double* values, std::size_t n) const
+{
+	if (m_stages.size() == 1)
+	{
+		// the common case, a single stage with its constants held in registers
+		const Stage stage = m_stages[0];
+		std::size_t kept = 0;
+		for (std::size_t i = 0; i < n; ++i)
+		{
+			double x = stage.scale * values[i] + stage.shift;
+			values[kept] = x;
+			kept += (x >= stage.low) & (x <= stage.high);
+		}
+		return kept;
+	}
+	std::size_t kept = 0;
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		double x = values[i];
+		bool keep = true;
+		for (const Stage& stage : m_stages)
+		{
+			x = stage.scale * x + stage.shift;
+			keep &= (x >= stage.low) & (x <= stage.high);
+		}
+		values[kept] = x;
+		kept += keep;
+	}
+	return kept;
+}
+
+void TimeSeriesPipeline::run(std::vector<double>& values, unsigned numThreads) const
+{
+	// each thread compacts its own chunk in place, then the kept parts are moved down to close the gaps
+	std::size_t n = values.size();
+	numThreads = std::max(1u, std::min<unsigned>(numThreads, unsigned(n / 65536 + 1)));
+	std::vector<std::size_t> kept(numThreads);
+	std::vector<std::thread> threads;
+	for (unsigned t = 0; t < numThreads; ++t)
+	{
+		auto runChunk = [&, t]() {
+			std::size_t begin = t * n / numThreads, end = (t + 1) * n / numThreads;
+			kept[t] = run(values.data() + begin, end - begin);
+		};
+		if (t + 1 < numThreads) threads.emplace_back(runChunk);
+		else runChunk();
+	}
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+
+	std::size_t total = kept[0];
+	for (unsigned t = 1; t < numThreads; ++t)
+	{
+		double* begin = values.data() + t * n / numThreads;
+		std::copy(begin, begin + kept[t], values.data() + total);  // moving left, so overlapping ranges are fine
+		total += kept[t];
+	}
+	values.resize(total);
+}
+
+std::size_t TimeSeriesPipeline::runStream(std::istream& in, std::ostream& out, std::size_t chunkSize) const
+{
+	// for histories larger than memory, only one chunk is resident at a time
+	std::vector<double> buffer(chunkSize);
+	std::size_t total = 0;
+	while (in)
+	{
+		in.read(reinterpret_cast<char*>(buffer.data()), std::streamsize(chunkSize * sizeof(double)));
+		std::size_t n = std::size_t(in.gcount()) / sizeof(double);
+		if (n == 0) break;
+		std::size_t kept = run(buffer.data(), n);
+		out.write(reinterpret_cast<const char*>(buffer.data()), std::streamsize(kept * sizeof(double)));
+		total += kept;
+	}
+	return total;
+}
+
 class TimeSeriesTransformations
 {
 public:
@@ -36,6 +197,8 @@ public:
 	double getFirstPriceLessThan(double val);
 	void addValue(double val);
 	void addValues(const std::vector<double>& val);
+	void transform(const TimeSeriesPipeline& pipeline, unsigned numThreads = 1);
+	const std::vector<double>& prices() const { return m_prices; }
 private:
 	std::vector<double> m_prices;
 };
@@ -66,31 +229,27 @@ TimeSeriesTransformations& TimeSeriesTransformations::operator= (const TimeSerie
 
 void TimeSeriesTransformations::reducePrices(double val)
 {
-	std::vector<double> neg(m_prices.size());
-	std::transform(m_prices.begin(), m_prices.end(), neg.begin(), std::bind2nd(std::minus<double>(), val));
-	m_prices.swap(neg);
+	std::transform(m_prices.begin(), m_prices.end(), m_prices.begin(), [val](double price) { return price - val; });  // in place, no second vector
 }
 
 void TimeSeriesTransformations::increasePrices(double val)
 {
-	std::for_each(m_prices.begin(), m_prices.end(), std::bind1st(std::plus
-		<double>(), val));
+	std::for_each(m_prices.begin(), m_prices.end(), [val](double& price) { price += val; });
 }
 void TimeSeriesTransformations::removePricesLessThan(double val)
 {
-	std::remove_if(m_prices.begin(), m_prices.end(), std::bind2nd(std::less
-		<double>(), val));
+	// remove_if only moves the kept values to the front, erase is what actually shrinks the vector
+	m_prices.erase(std::remove_if(m_prices.begin(), m_prices.end(), [val](double price) { return price < val; }), m_prices.end());
 }
 
 void TimeSeriesTransformations::removePricesGreaterThan(double val)
 {
-	std::remove_if(m_prices.begin(), m_prices.end(), std::bind2nd(std::
-		greater<double>(), val));
+	m_prices.erase(std::remove_if(m_prices.begin(), m_prices.end(), [val](double price) { return price > val; }), m_prices.end());
 }
 double TimeSeriesTransformations::getFirstPriceLessThan(double val)
 {
 	auto res = std::find_if(m_prices.begin(), m_prices.end(),
-		std::bind2nd(std::less<double>(), val));
+		[val](double price) { return price < val; });
 	if (res != m_prices.end())
 		return *res;
 	return 0;
@@ -103,12 +262,54 @@ void TimeSeriesTransformations::addValues(const std::vector<double>& val)
 {
 	m_prices.insert(m_prices.end(), val.begin(), val.end());
 }
+void TimeSeriesTransformations::transform(const TimeSeriesPipeline& pipeline, unsigned numThreads)
+{
+	pipeline.run(m_prices, numThreads);
+}
+
+void benchmarkTimeSeriesPipeline(std::size_t n)
+{
+	std::vector<double> prices(n);
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		prices[i] = 100 + 10 * std::sin(0.001 * i);
+	}
+
+	TimeSeriesTransformations separate;
+	separate.addValues(prices);
+	auto start = std::chrono::steady_clock::now();
+	separate.reducePrices(1.5);
+	separate.increasePrices(0.25);
+	separate.removePricesLessThan(92);
+	separate.removePricesGreaterThan(105);
+	double separateSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	TimeSeriesPipeline pipeline;
+	pipeline.add(-1.5).add(0.25).removeLessThan(92).removeGreaterThan(105);
+	TimeSeriesTransformations fused;
+	fused.addValues(prices);
+	start = std::chrono::steady_clock::now();
+	fused.transform(pipeline);
+	double fusedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	TimeSeriesTransformations parallel;
+	parallel.addValues(prices);
+	start = std::chrono::steady_clock::now();
+	parallel.transform(pipeline, std::thread::hardware_concurrency());
+	double parallelSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::cout << n << " prices: separate passes " << separateSeconds * 1e3 << " ms, fused " << fusedSeconds * 1e3 << " ms, parallel fused "
+		<< parallelSeconds * 1e3 << " ms, kept " << fused.prices().size() << " / " << separate.prices().size() << " / " << parallel.prices().size() << std::endl;
+}
 
 // boost can be used to work efficiently with files
 
 // class for handling dates
-// Lets see how to create a class that can be used to determine trading days for common securities, which are negotiated from Monday to Friday.
-/*
+// Let's see how to create a class that can be used to determine trading days for common securities, which are negotiated from Monday to Friday.
+// a Date is stored as a serial day number (days since 1970-01-01) alongside its year, month and day
+// converting between the two is a handful of integer operations (Howard Hinnant's civil calendar algorithms),
+// so comparing dates, counting the days between them and finding the day of the week are all O(1)
+
 class Date
 {
 public:
@@ -125,21 +326,52 @@ public:
 
 	Date(int year, int month, int day);
 	~Date();
-	bool isLeapYear();
+	static Date fromSerial(int serial);
+	bool isLeapYear() const;
 	Date& operator++();
-	bool operator<(const Date& d);
-	DayOfWeek getDayOfWeek();
-	int daysInterval(const Date& v);
-	bool isTradingDay();
+	Date& operator+=(int days);
+	bool operator<(const Date& d) const { return m_serial < d.m_serial; }
+	bool operator==(const Date& d) const { return m_serial == d.m_serial; }
+	DayOfWeek getDayOfWeek() const;
+	int daysInterval(const Date& v) const;  // number of days from v to this date
+	bool isTradingDay() const;
 	std::string toStringDate(Date::DayOfWeek day);
+	Date addMonths(int months) const;  // same day of month, moved back to the month end if the month is shorter
+
+	int year() const { return m_year; }
+	int month() const { return m_month; }
+	int day() const { return m_day; }
+	int serial() const { return m_serial; }
+
+	static constexpr int daysFromCivil(int year, int month, int day);
+	static int daysInMonth(int year, int month);
 
 private:
+	int m_serial;
 	int m_year;
 	int m_month;
 	int m_day;
 };
 
-Date::Date(int year, int month, int day) : m_year(year), m_month(month), m_day(day)
+constexpr int Date::daysFromCivil(int year, int month, int day)
+{
+	// count from 0000-03-01 so the leap day falls at the end of each 400 year era
+	year -= month <= 2;
+	const int era = (year >= 0 ? year : year - 399) / 400;
+	const int yearOfEra = year - era * 400;                                       // [0, 399]
+	const int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1; // [0, 365]
+	const int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+	return era * 146097 + dayOfEra - 719468;
+}
+
+int Date::daysInMonth(int year, int month)
+{
+	static const int kDays[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+	bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+	return (month == 2 && leap) ? 29 : kDays[month - 1];
+}
+
+Date::Date(int year, int month, int day) : m_serial(daysFromCivil(year, month, day)), m_year(year), m_month(month), m_day(day)
 {
 
 }
@@ -149,7 +381,21 @@ Date::~Date()
 
 }
 
-bool Date::isLeapYear()
+Date Date::fromSerial(int serial)
+{
+	// inverse of daysFromCivil
+	serial += 719468;
+	const int era = (serial >= 0 ? serial : serial - 146096) / 146097;
+	const int dayOfEra = serial - era * 146097;
+	const int yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+	const int dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+	const int mp = (5 * dayOfYear + 2) / 153;
+	const int day = dayOfYear - (153 * mp + 2) / 5 + 1;
+	const int month = mp < 10 ? mp + 3 : mp - 9;
+	return Date(yearOfEra + era * 400 + (month <= 2), month, day);
+}
+
+bool Date::isLeapYear() const
 {
 	if (m_year % 4 != 0) return false;
 	if (m_year % 100 != 0) return true;
@@ -159,34 +405,14 @@ bool Date::isLeapYear()
 
 Date& Date::operator++()
 {
-	std::vector<int> monthsWith31Days = { 1,3,5,7,8,10,12 };
-	if (m_day == 31)
-	{
-		m_day = 1;
-		m_month++;
-	}
-	else if (m_day == 30 &&
-		std::find(monthsWith31Days.begin(),
-			monthsWith31Days.end(), m_month) == monthsWith31Days.end())
-	{
-		m_day = 1;
-		m_month++;
-	}
-	else if (m_day == 29 && m_month == 2)
-	{
-		m_day = 1;
-		m_month++;
-	}
-	else if (m_day == 28 && m_month == 2 && !isLeapYear())
-	{
-		m_day = 1;
-		m_month++;
-	}
-	else
+	++m_serial;
+	if (m_day < daysInMonth(m_year, m_month))
 	{
 		m_day++;
+		return *this;
 	}
-	if (m_month > 12)
+	m_day = 1;
+	if (++m_month > 12)
 	{
 		m_month = 1;
 		m_year++;
@@ -194,37 +420,25 @@ Date& Date::operator++()
 	return *this;
 }
 
-int Date::daysInterval(const Date& d)
+Date& Date::operator+=(int days)
 {
-	Date bdate1(m_year, m_month, m_day);
-	Date bdate2(d.m_year, d.m_month, d.m_day);
-
-	// boost::gregorian::date_duration duration = bdate1 - bdate2; // not working
-//	return (int)duration.days();
-	return 0;
+	*this = fromSerial(m_serial + days);
+	return *this;
 }
 
-bool Date::operator<(const Date& d)
+int Date::daysInterval(const Date& d) const
 {
-	if (m_year < d.m_year) return true;
-	if (m_year == d.m_year && m_month < d.m_month) return true;
-	if (m_year == d.m_year && m_month == d.m_month && m_day < d.m_day) return true;
-	return false;
+	return m_serial - d.m_serial;
 }
 
-Date::DayOfWeek Date::getDayOfWeek()
+Date::DayOfWeek Date::getDayOfWeek() const
 {
-	int day = 1;
-	Date d(1900, 1, 1);
-	for (; d < *this; ++d)
-	{
-		if (day == 7) day = 1;
-		else day++;
-	}
-	return (DayOfWeek)day;
+	// 1970-01-01 was a Thursday
+	int day = (m_serial + 4) % 7;
+	return (DayOfWeek)(day < 0 ? day + 7 : day);
 }
 
-bool Date::isTradingDay()
+bool Date::isTradingDay() const
 {
 	DayOfWeek dayOfWeek = getDayOfWeek();
 	if (dayOfWeek == DayOfWeek::Sun || dayOfWeek == DayOfWeek::Sat)
@@ -249,19 +463,234 @@ std::string Date::toStringDate(Date::DayOfWeek day)
 	throw std::runtime_error("unknown day of week");
 }
 
-*/
+Date Date::addMonths(int months) const
+{
+	int monthIndex = m_year * 12 + (m_month - 1) + months;
+	int year = monthIndex / 12;
+	int month = monthIndex % 12 + 1;
+	return Date(year, month, std::min(m_day, daysInMonth(year, month)));
+}
+
+// Day count conventions
+// the interest accrued between two dates is rate * year fraction, and each market has its own rule for the year fraction
+// ACT/360 (money markets) and ACT/365 (sterling) use the actual number of days, 30/360 (US bonds) pretends every month has 30 days
+
+enum class DayCountConvention
+{
+	Act360,
+	Act365,
+	Thirty360
+};
+
+double yearFraction(const Date& start, const Date& end, DayCountConvention convention)
+{
+	switch (convention)
+	{
+	case DayCountConvention::Act360: return end.daysInterval(start) / 360.0;
+	case DayCountConvention::Act365: return end.daysInterval(start) / 365.0;
+	case DayCountConvention::Thirty360:
+	{
+		int d1 = std::min(start.day(), 30);
+		int d2 = (end.day() == 31 && d1 == 30) ? 30 : end.day();
+		return (360 * (end.year() - start.year()) + 30 * (end.month() - start.month()) + (d2 - d1)) / 360.0;
+	}
+	}
+	throw std::runtime_error("unknown day count convention");
+}
+
+// Business day calendars
+// payments can't be made on weekends or holidays, so a payment date that lands on one is moved by an adjustment rule
+// Following moves to the next business day, Preceding to the previous one,
+// and ModifiedFollowing moves forward unless that crosses into the next month, in which case it moves back instead
+
+enum class BusinessDayConvention
+{
+	Unadjusted,
+	Following,
+	ModifiedFollowing,
+	Preceding
+};
+
+// the calendar keeps one bit per day from 1970 to 2099, with weekends and holidays both set,
+// so checking a business day is a single bit test instead of a weekday calculation and a search through a holiday list
+class HolidayCalendar
+{
+public:
+	static constexpr int kFirstSerial = Date::daysFromCivil(1970, 1, 1);
+	static constexpr int kNumDays = Date::daysFromCivil(2100, 1, 1) - kFirstSerial;
+
+	HolidayCalendar();
+	void addHoliday(const Date& d);
+	bool isBusinessDay(const Date& d) const { return isBusinessDay(d.serial()); }
+	bool isBusinessDay(int serial) const;
+	Date adjust(const Date& d, BusinessDayConvention convention) const;
+	int adjust(int serial, BusinessDayConvention convention) const;
+
+private:
+	std::bitset<kNumDays> m_closed;
+};
+
+HolidayCalendar::HolidayCalendar()
+{
+	for (int i = 0; i < kNumDays; ++i)
+	{
+		int weekday = (kFirstSerial + i + 4) % 7;
+		m_closed[i] = weekday == 0 || weekday == 6;
+	}
+}
+
+void HolidayCalendar::addHoliday(const Date& d)
+{
+	int i = d.serial() - kFirstSerial;
+	if (i >= 0 && i < kNumDays) m_closed[i] = true;
+}
+
+bool HolidayCalendar::isBusinessDay(int serial) const
+{
+	int i = serial - kFirstSerial;
+	if (i >= 0 && i < kNumDays) return !m_closed[i];
+	return Date::fromSerial(serial).isTradingDay();  // outside the table only weekends are known
+}
+
+int HolidayCalendar::adjust(int serial, BusinessDayConvention convention) const
+{
+	int adjusted = serial;
+	switch (convention)
+	{
+	case BusinessDayConvention::Unadjusted:
+		break;
+	case BusinessDayConvention::Following:
+		while (!isBusinessDay(adjusted)) ++adjusted;
+		break;
+	case BusinessDayConvention::Preceding:
+		while (!isBusinessDay(adjusted)) --adjusted;
+		break;
+	case BusinessDayConvention::ModifiedFollowing:
+		while (!isBusinessDay(adjusted)) ++adjusted;
+		if (Date::fromSerial(adjusted).month() != Date::fromSerial(serial).month())
+		{
+			adjusted = serial;
+			while (!isBusinessDay(adjusted)) --adjusted;
+		}
+		break;
+	}
+	return adjusted;
+}
+
+Date HolidayCalendar::adjust(const Date& d, BusinessDayConvention convention) const
+{
+	return Date::fromSerial(adjust(d.serial(), convention));
+}
+
+// Payment schedules
+// a schedule is stored as flat arrays (structure of arrays), the payment dates as serial numbers and the accrual
+// fraction of each period, so the year fractions for ACT conventions are one subtract and multiply loop the compiler vectorises
+// unadjusted dates are rolled from the start date by whole months, never from the previous date, so month ends don't drift
+
+struct PaymentSchedule
+{
+	std::vector<int> paymentDates;          // adjusted, as Date serials
+	std::vector<double> accrualFractions;   // accrual from the previous payment (or the start) to this one
+};
+
+void generateSchedule(const Date& start, const Date& maturity, int frequencyMonths, const HolidayCalendar& calendar,
+	BusinessDayConvention adjustment, DayCountConvention dayCount, PaymentSchedule& schedule)
+{
+	schedule.paymentDates.clear();
+	schedule.accrualFractions.clear();
+
+	int startSerial = calendar.adjust(start.serial(), adjustment);
+	for (int k = 1; ; ++k)
+	{
+		Date unadjusted = start.addMonths(k * frequencyMonths);
+		if (!(unadjusted < maturity))
+		{
+			schedule.paymentDates.push_back(calendar.adjust(maturity.serial(), adjustment));  // final period, possibly a short stub
+			break;
+		}
+		schedule.paymentDates.push_back(calendar.adjust(unadjusted.serial(), adjustment));
+	}
+
+	std::size_t n = schedule.paymentDates.size();
+	schedule.accrualFractions.resize(n);
+	const int* dates = schedule.paymentDates.data();
+	double* fractions = schedule.accrualFractions.data();
+	if (dayCount == DayCountConvention::Thirty360)
+	{
+		Date previous = Date::fromSerial(startSerial);
+		for (std::size_t i = 0; i < n; ++i)
+		{
+			Date current = Date::fromSerial(dates[i]);
+			fractions[i] = yearFraction(previous, current, dayCount);
+			previous = current;
+		}
+		return;
+	}
+	double scale = dayCount == DayCountConvention::Act360 ? 1 / 360.0 : 1 / 365.0;
+	fractions[0] = (dates[0] - startSerial) * scale;
+	for (std::size_t i = 1; i < n; ++i)
+	{
+		fractions[i] = (dates[i] - dates[i - 1]) * scale;
+	}
+}
+
+void benchmarkSwapBookSchedules(int numSwaps)
+{
+	// a book of quarterly swaps from 1 to 30 years, starting on successive days
+	HolidayCalendar calendar;
+	calendar.addHoliday(Date(2025, 12, 25));
+	calendar.addHoliday(Date(2026, 1, 1));
+	PaymentSchedule schedule;
+	std::size_t totalPayments = 0;
+	double totalAccrual = 0;
+
+	auto begin = std::chrono::steady_clock::now();
+	for (int i = 0; i < numSwaps; ++i)
+	{
+		Date start = Date::fromSerial(Date(2025, 1, 2).serial() + i % 365);
+		Date maturity = start.addMonths(12 * (1 + i % 30));
+		generateSchedule(start, maturity, 3, calendar, BusinessDayConvention::ModifiedFollowing, DayCountConvention::Act360, schedule);
+		totalPayments += schedule.paymentDates.size();
+		for (double f : schedule.accrualFractions) totalAccrual += f;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	std::cout << numSwaps << " swap schedules, " << totalPayments << " payments in " << seconds * 1e3 << " ms (total accrual "
+		<< totalAccrual << ")" << std::endl;
+}
+
 // Designing Numerical Classes
 // implement a class that represents a matrix with common associated operations
+// the elements live in one contiguous row-major block, element (i, j) is at m_data[i * m_cols + j]
+// a vector of vectors puts every row in its own heap allocation, which costs a pointer chase per row and defeats prefetching
+// operator[] returns a pointer to the start of the row, so m[i][j] still works as before
+
+// Expression templates
+// with plain operators, A + B - C builds a temporary matrix for A + B and then another for the result
+// instead, + and - return a small object describing the operation, and the work happens only when it is assigned to a Matrix,
+// in a single loop over the elements that computes a[i] + b[i] - c[i] directly, with no temporaries
+template <typename E>
+class MatrixExpression
+{
+public:
+	double element(std::size_t i) const { return static_cast<const E&>(*this).element(i); }
+	int rows() const { return static_cast<const E&>(*this).rows(); }
+	int cols() const { return static_cast<const E&>(*this).cols(); }
+};
 
-class Matrix
+class Matrix : public MatrixExpression<Matrix>
 {
 public:
-	typedef std::vector<double> Row;
 	Matrix(int size, int size2);
 	Matrix(int size);
 	Matrix(const Matrix& s);
+	Matrix(Matrix&& s) noexcept = default;  // lets a temporary be moved into an expression rather than copied
+	template <typename E>
+	Matrix(const MatrixExpression<E>& e);
 	~Matrix();
 	Matrix& operator= (const Matrix& s);
+	Matrix& operator= (Matrix&& s) noexcept = default;
+	template <typename E>
+	Matrix& operator= (const MatrixExpression<E>& e);
 
 	void transpose();
 	double trace();
@@ -269,151 +698,497 @@ public:
 	void subtract(const Matrix& v);
 	void multiply(const Matrix& v);
 
-	Row& operator[] (int pos);
+	double* operator[] (int pos) { return m_data.data() + std::size_t(pos) * m_cols; }
+	const double* operator[] (int pos) const { return m_data.data() + std::size_t(pos) * m_cols; }
+	double element(std::size_t i) const { return m_data[i]; }
+	int rows() const { return m_rows; }
+	int cols() const { return m_cols; }
+	double* data() { return m_data.data(); }
+	const double* data() const { return m_data.data(); }
 
 private:
-	std::vector<Row> m_rows;
+	int m_rows;
+	int m_cols;
+	std::vector<double> m_data;
+
+	template <typename E>
+	void assign(const MatrixExpression<E>& e);
 };
 
-// free operators
-Matrix operator+ (const Matrix& s1, const Matrix& s2);
-Matrix operator- (const Matrix& s1, const Matrix& s2);
-Matrix operator* (const Matrix& s1, const Matrix& s2);
+// the operators forward their operands, so L and R below are Matrix& for a named matrix and plain Matrix for a temporary
+// nested expressions are small and are stored by value, and named matrices are stored by reference so nothing is copied
+// a temporary matrix is moved into the expression instead, otherwise auto e = a + Matrix(...) would point at a destroyed matrix
+template <typename E> struct ExpressionStorage { typedef std::remove_cvref_t<E> type; };
+template <> struct ExpressionStorage<Matrix&> { typedef const Matrix& type; };
+template <> struct ExpressionStorage<const Matrix&> { typedef const Matrix& type; };
+
+template <typename E>
+concept MatrixOperand = std::is_base_of_v<MatrixExpression<std::remove_cvref_t<E>>, std::remove_cvref_t<E>>;
 
-Matrix::Matrix(int size)
+struct AddOp { static double apply(double a, double b) { return a + b; } };
+struct SubtractOp { static double apply(double a, double b) { return a - b; } };
+
+template <typename L, typename R, typename Op>
+class MatrixBinaryExpression : public MatrixExpression<MatrixBinaryExpression<L, R, Op>>
 {
-	for (unsigned i = 0; i < size; ++i)
+public:
+	template <typename A, typename B>
+	MatrixBinaryExpression(A&& left, B&& right) : m_left(std::forward<A>(left)), m_right(std::forward<B>(right))
 	{
-		std::vector<double> row(size, 0);
-		m_rows.push_back(row);
+		if (m_left.rows() != m_right.rows() || m_left.cols() != m_right.cols())  // the stored operands, a temporary has been moved from
+		{
+			throw std::runtime_error("invalid matrix dimensions");
+		}
 	}
+	double element(std::size_t i) const { return Op::apply(m_left.element(i), m_right.element(i)); }
+	int rows() const { return m_left.rows(); }
+	int cols() const { return m_left.cols(); }
+
+private:
+	typename ExpressionStorage<L>::type m_left;
+	typename ExpressionStorage<R>::type m_right;
+};
+
+// free operators
+template <MatrixOperand L, MatrixOperand R>
+MatrixBinaryExpression<L, R, AddOp> operator+ (L&& s1, R&& s2)
+{
+	return MatrixBinaryExpression<L, R, AddOp>(std::forward<L>(s1), std::forward<R>(s2));
+}
+
+template <MatrixOperand L, MatrixOperand R>
+MatrixBinaryExpression<L, R, SubtractOp> operator- (L&& s1, R&& s2)
+{
+	return MatrixBinaryExpression<L, R, SubtractOp>(std::forward<L>(s1), std::forward<R>(s2));
+}
+
+Matrix operator* (const Matrix& s1, const Matrix& s2);
+
+Matrix::Matrix(int size, int size2) : m_rows(size), m_cols(size2), m_data(std::size_t(size) * size2, 0)
+{
+}
+
+Matrix::Matrix(int size) : Matrix(size, size)
+{
 }
 
 Matrix::Matrix(const Matrix& s)
-	: m_rows(s.m_rows)
+	: m_rows(s.m_rows), m_cols(s.m_cols), m_data(s.m_data)
+{
+}
+
+template <typename E>
+Matrix::Matrix(const MatrixExpression<E>& e) : m_rows(e.rows()), m_cols(e.cols()), m_data(std::size_t(e.rows()) * e.cols())
 {
+	assign(e);
 }
+
 Matrix::~Matrix()
 {
 }
+
 Matrix& Matrix::operator=(const Matrix& s)
 {
 	if (this != &s)
 	{
 		m_rows = s.m_rows;
+		m_cols = s.m_cols;
+		m_data = s.m_data;
 	}
 	return *this;
 }
 
-Matrix::Row& Matrix::operator[](int pos)
+template <typename E>
+Matrix& Matrix::operator=(const MatrixExpression<E>& e)
 {
-	return m_rows[pos];
+	// every element only reads the same position of its operands, so A = A + B is safe to evaluate in place
+	if (m_rows != e.rows() || m_cols != e.cols())
+	{
+		Matrix result(e);
+		m_data.swap(result.m_data);
+		m_rows = result.m_rows;
+		m_cols = result.m_cols;
+		return *this;
+	}
+	assign(e);
+	return *this;
+}
+
+template <typename E>
+void Matrix::assign(const MatrixExpression<E>& e)
+{
+	const E& expression = static_cast<const E&>(e);
+	double* out = m_data.data();
+	std::size_t n = m_data.size();
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		out[i] = expression.element(i);
+	}
 }
 
 void Matrix::transpose()
 {
-	std::vector<Row> rows;
-	for (unsigned i = 0; i < m_rows[0].size(); ++i)
+	std::vector<double> data(m_data.size());
+	for (int i = 0; i < m_rows; ++i)
 	{
-		std::vector<double> row;
-			for (unsigned j = 0; j < m_rows.size(); ++j)
-			{
-				row[j] = m_rows[j][i];
-			}
-		rows.push_back(row);
+		for (int j = 0; j < m_cols; ++j)
+		{
+			data[std::size_t(j) * m_rows + i] = m_data[std::size_t(i) * m_cols + j];
+		}
 	}
-	m_rows.swap(rows);
+	m_data.swap(data);
+	std::swap(m_rows, m_cols);
 }
 
 double Matrix::trace()
 {
-	if (m_rows.size() != m_rows[0].size())
+	if (m_rows != m_cols)
 	{
 		return 0;
 	}
 	double total = 0;
-	for (unsigned i = 0; i < m_rows.size(); ++i)
+	for (int i = 0; i < m_rows; ++i)
 	{
-		total += m_rows[i][i];
+		total += m_data[std::size_t(i) * m_cols + i];
 	}
 	return total;
 }
 
 void Matrix::add(const Matrix& s)
 {
-	if (m_rows.size() != s.m_rows.size() ||
-		m_rows[0].size() != s.m_rows[0].size())
+	*this = *this + s;
+}
+
+void Matrix::subtract(const Matrix& s)
+{
+	*this = *this - s;
+}
+
+// Matrix multiplication
+// the naive i-j-k loop walks down a column of the right matrix, touching a new cache line for every multiply
+// here C = A * B is computed in tiles: a block of rows of A is multiplied by a block of B small enough to stay in cache,
+// and the innermost loop runs along a row of B and a row of C, which is contiguous and vectorises into SIMD multiply-adds
+// tiles of rows of C are independent, so threads take them from a shared atomic counter
+
+void gemm(const Matrix& a, const Matrix& b, Matrix& c, unsigned numThreads = std::thread::hardware_concurrency())
+{
+	const int kRowBlock = 64, kDepthBlock = 256, kColBlock = 512;
+	const int n = a.rows(), depth = a.cols(), m = b.cols();
+	std::fill(c.data(), c.data() + std::size_t(n) * m, 0.0);
+
+	int numTiles = (n + kRowBlock - 1) / kRowBlock;
+	std::atomic<int> nextTile(0);
+	auto worker = [&]() {
+		for (int tile = nextTile++; tile < numTiles; tile = nextTile++)
+		{
+			int i0 = tile * kRowBlock, i1 = std::min(n, i0 + kRowBlock);
+			for (int j0 = 0; j0 < m; j0 += kColBlock)
+			{
+				int j1 = std::min(m, j0 + kColBlock);
+				for (int k0 = 0; k0 < depth; k0 += kDepthBlock)
+				{
+					int k1 = std::min(depth, k0 + kDepthBlock);
+					for (int i = i0; i < i1; ++i)
+					{
+						const double* aRow = a[i];
+						double* cRow = c[i];
+						for (int k = k0; k < k1; ++k)
+						{
+							const double aik = aRow[k];
+							const double* bRow = b[k];
+							for (int j = j0; j < j1; ++j)
+							{
+								cRow[j] += aik * bRow[j];
+							}
+						}
+					}
+				}
+			}
+		}
+	};
+
+	numThreads = std::max(1u, std::min<unsigned>(numThreads, numTiles));
+	std::vector<std::thread> threads;
+	for (unsigned t = 1; t < numThreads; ++t)
 	{
-		throw new std::runtime_error("invalid matrix dimensions");
+		threads.emplace_back(worker);
 	}
-	for (unsigned i = 0; i < m_rows.size(); ++i)
+	worker();
+	for (std::thread& thread : threads)
 	{
-		for (unsigned j = 0; j < m_rows[0].size(); ++j)
-		{
-			m_rows[i][j] += s.m_rows[i][j];
-		}
+		thread.join();
 	}
 }
 
-void Matrix::subtract(const Matrix& s)
+void Matrix::multiply(const Matrix& s)
 {
-	if (m_rows.size() != s.m_rows.size() ||
-		m_rows[0].size() != s.m_rows[0].size())
+	if (m_cols != s.m_rows)
 	{
-		throw new std::runtime_error("invalid matrix dimensions");
+		throw std::runtime_error("invalid matrix dimensions");
+	}
+	Matrix result(m_rows, s.m_cols);
+	gemm(*this, s, result);
+	*this = result;
+}
+
+Matrix operator*(const Matrix& s1, const Matrix& s2)
+{
+	if (s1.cols() != s2.rows())
+	{
+		throw std::runtime_error("invalid matrix dimensions");
+	}
+	Matrix s(s1.rows(), s2.cols());
+	gemm(s1, s2, s);
+	return s;
+}
+
+// the original vector of vectors multiply, kept to measure against
+std::vector<std::vector<double>> naiveMultiply(const std::vector<std::vector<double>>& a, const std::vector<std::vector<double>>& b)
+{
+	std::vector<std::vector<double>> rows;
+	for (unsigned i = 0; i < a.size(); ++i)
+	{
+		std::vector<double> row;
+		for (unsigned j = 0; j < b[0].size(); ++j)
+		{
+			double Mij = 0;
+			for (unsigned k = 0; k < a[0].size(); ++k)
+			{
+				Mij += a[i][k] * b[k][j];
+			}
+			row.push_back(Mij);
+		}
+		rows.push_back(row);
 	}
-	for (unsigned i = 0; i < m_rows.size(); ++i)
+	return rows;
+}
+
+// the naive loop is O(n^3) with a cache miss on nearly every b[k][j], at n = 2048 it takes about a minute
+// every row of the result costs the naive loop the same (a full pass over b), so above maxNaiveSize it only computes
+// sampleRows evenly spaced rows and scales the time up by n / sampleRows, and those rows still check the blocked result
+void benchmarkMatrixMultiply(const std::vector<int>& sizes, int maxNaiveSize = 512, int sampleRows = 64)
+{
+	for (int n : sizes)
 	{
-		for (unsigned j = 0; j < m_rows[0].size(); ++j)
+		int naiveRows = n > maxNaiveSize ? std::min(sampleRows, n) : n;
+		std::vector<int> rowIndex(naiveRows);
+		for (int r = 0; r < naiveRows; ++r)
+		{
+			rowIndex[r] = int(static_cast<long long>(r) * n / naiveRows);
+		}
+
+		Matrix a(n), b(n);
+		std::vector<std::vector<double>> naiveA(naiveRows, std::vector<double>(n)), naiveB(n, std::vector<double>(n));
+		for (int i = 0; i < n; ++i)
+		{
+			for (int j = 0; j < n; ++j)
+			{
+				a[i][j] = std::sin(i + 2.0 * j);
+				b[i][j] = naiveB[i][j] = std::cos(2.0 * i - j);
+			}
+		}
+		for (int r = 0; r < naiveRows; ++r)
 		{
-			m_rows[i][j] += s.m_rows[i][j];
+			naiveA[r].assign(a[rowIndex[r]], a[rowIndex[r]] + n);
 		}
+
+		auto start = std::chrono::steady_clock::now();
+		std::vector<std::vector<double>> naiveC = naiveMultiply(naiveA, naiveB);
+		double naiveSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * n / naiveRows;
+
+		start = std::chrono::steady_clock::now();
+		Matrix c = a * b;
+		double blockedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		double maxError = 0;
+		for (int r = 0; r < naiveRows; ++r)
+		{
+			for (int j = 0; j < n; ++j)
+			{
+				maxError = std::max(maxError, std::abs(c[rowIndex[r]][j] - naiveC[r][j]));
+			}
+		}
+		double flops = 2.0 * n * n * n;
+		std::cout << "n = " << n << " naive " << naiveSeconds * 1e3 << " ms (";
+		if (naiveRows < n)
+		{
+			std::cout << "estimated from " << naiveRows << " of " << n << " rows, ";
+		}
+		std::cout << flops / naiveSeconds * 1e-9 << " GFLOP/s), blocked " << blockedSeconds * 1e3 << " ms (" << flops / blockedSeconds * 1e-9
+			<< " GFLOP/s), speedup " << naiveSeconds / blockedSeconds << "x, max difference " << maxError << std::endl;
 	}
 }
 
-void Matrix::multiply(const Matrix& s)
+// Correlated random numbers
+// a basket or spread option needs shocks that move together the way the assets do, described by a correlation matrix C
+// the Cholesky factorisation writes C = L * L^T with L lower triangular; if z is a vector of independent standard normals,
+// x = L * z has exactly the correlation C. Factorising costs O(N^3) but it is done once, before any path is generated
+
+Matrix choleskyDecomposition(const Matrix& correlation)
 {
-	if (m_rows[0].size() != s.m_rows.size())
+	int n = correlation.rows();
+	if (n != correlation.cols())
 	{
-		throw new std::runtime_error("invalid matrix dimensions");
+		throw std::runtime_error("invalid matrix dimensions");
 	}
-	std::vector<Row> rows;
-	for (unsigned i = 0; i < m_rows.size(); ++i)
+	Matrix lower(n);
+	for (int j = 0; j < n; ++j)
 	{
-		std::vector<double> row;
-		for (unsigned j = 0; j < s.m_rows.size(); ++j)
+		double diagonal = correlation[j][j];
+		for (int k = 0; k < j; ++k)
 		{
-			double Mij = 0;
-			for (unsigned k = 0; k < m_rows[0].size(); ++k)
+			diagonal -= lower[j][k] * lower[j][k];
+		}
+		if (diagonal <= 0)
+		{
+			throw std::runtime_error("correlation matrix is not positive definite");
+		}
+		lower[j][j] = std::sqrt(diagonal);
+		for (int i = j + 1; i < n; ++i)
+		{
+			// rows i and j of L are both contiguous, so this dot product vectorises
+			double total = correlation[i][j];
+			for (int k = 0; k < j; ++k)
 			{
-				Mij += m_rows[i][k] * s.m_rows[k][j];
+				total -= lower[i][k] * lower[j][k];
 			}
-				row.push_back(Mij);
+			lower[i][j] = total / lower[j][j];
 		}
-		rows.push_back(row);
 	}
-	m_rows.swap(rows);
+	return lower;
 }
 
-Matrix operator+(const Matrix& s1, const Matrix& s2)
+// out = z * upper for an upper triangular matrix, row k of upper is zero before column k so those multiplies are skipped
+// same layout as gemm: the inner loop runs along contiguous rows, and threads take tiles of rows from an atomic counter
+void triangularMultiply(const Matrix& z, const Matrix& upper, Matrix& out, unsigned numThreads = std::thread::hardware_concurrency())
 {
-	Matrix s(s1);
-	s.subtract(s2);
-	return s;
+	const int kRowBlock = 256;
+	const int rows = z.rows(), n = z.cols();
+	int numTiles = (rows + kRowBlock - 1) / kRowBlock;
+	std::atomic<int> nextTile(0);
+	auto worker = [&]() {
+		for (int tile = nextTile++; tile < numTiles; tile = nextTile++)
+		{
+			int i1 = std::min(rows, (tile + 1) * kRowBlock);
+			for (int i = tile * kRowBlock; i < i1; ++i)
+			{
+				const double* zRow = z[i];
+				double* outRow = out[i];
+				std::fill(outRow, outRow + n, 0.0);
+				for (int k = 0; k < n; ++k)
+				{
+					const double zik = zRow[k];
+					const double* uRow = upper[k];
+					for (int a = k; a < n; ++a)
+					{
+						outRow[a] += zik * uRow[a];
+					}
+				}
+			}
+		}
+	};
+
+	numThreads = std::max(1u, std::min<unsigned>(numThreads, numTiles));
+	std::vector<std::thread> threads;
+	for (unsigned t = 1; t < numThreads; ++t)
+	{
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
 }
-Matrix operator-(const Matrix& s1, const Matrix& s2)
+
+// turns blocks of independent normals into correlated ones
+// a block is a (paths x assets) Matrix, one path per row, so the whole block is correlated with a single
+// triangular matrix-matrix multiply X = Z * L^T instead of one small matrix-vector product per path
+class CorrelatedNormalGenerator
 {
-	Matrix s(s1);
-	s.subtract(s2);
-	return s;
+public:
+	CorrelatedNormalGenerator(const Matrix& correlation, unsigned long long seed);
+	int numAssets() const { return m_upper.rows(); }
+	void generate(Matrix& block);  // fills every row of block, block.cols() must equal numAssets()
+
+private:
+	Matrix m_upper;  // L^T
+	Matrix m_independent;
+	std::mt19937_64 m_engine;
+	std::normal_distribution<double> m_normal;
+};
+
+CorrelatedNormalGenerator::CorrelatedNormalGenerator(const Matrix& correlation, unsigned long long seed)
+	: m_upper(choleskyDecomposition(correlation)), m_independent(0), m_engine(seed)
+{
+	m_upper.transpose();
 }
-Matrix operator*(const Matrix& s1, const Matrix& s2)
+
+void CorrelatedNormalGenerator::generate(Matrix& block)
 {
-	Matrix s(s1);
-	s.multiply(s2);
-	return s;
+	if (block.cols() != numAssets())
+	{
+		throw std::runtime_error("invalid matrix dimensions");
+	}
+	if (m_independent.rows() != block.rows())
+	{
+		m_independent = Matrix(block.rows(), numAssets());
+	}
+	double* z = m_independent.data();
+	std::size_t count = std::size_t(block.rows()) * numAssets();
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		z[i] = m_normal(m_engine);
+	}
+	triangularMultiply(m_independent, m_upper, block);
+}
+
+// prices an equally weighted basket call by one step Monte Carlo, with every pair of assets correlated by rho
+// the time is split between drawing the normals, correlating them and evaluating the payoff, to show how small
+// the correlation step is next to drawing the numbers, even for 50 assets
+void benchmarkBasketSimulation(int numAssets, int numPaths, double rho)
+{
+	const int kBlockPaths = 4096;
+	const double spot = 100, strike = 100, rate = 0.03, vol = 0.2, expiry = 1.0;
+	Matrix correlation(numAssets);
+	for (int i = 0; i < numAssets; ++i)
+	{
+		for (int j = 0; j < numAssets; ++j)
+		{
+			correlation[i][j] = (i == j) ? 1.0 : rho;
+		}
+	}
+	CorrelatedNormalGenerator generator(correlation, 42);
+	Matrix block(kBlockPaths, numAssets);
+	double drift = (rate - 0.5 * vol * vol) * expiry, diffusion = vol * std::sqrt(expiry);
+
+	double total = 0, generateSeconds = 0, payoffSeconds = 0;
+	for (int done = 0; done < numPaths; done += kBlockPaths)
+	{
+		auto start = std::chrono::steady_clock::now();
+		generator.generate(block);
+		auto generated = std::chrono::steady_clock::now();
+		int paths = std::min(kBlockPaths, numPaths - done);
+		for (int p = 0; p < paths; ++p)
+		{
+			const double* x = block[p];
+			double basket = 0;
+			for (int a = 0; a < numAssets; ++a)
+			{
+				basket += std::exp(drift + diffusion * x[a]);
+			}
+			total += std::max(spot * basket / numAssets - strike, 0.0);
+		}
+		generateSeconds += std::chrono::duration<double>(generated - start).count();
+		payoffSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - generated).count();
+	}
+	double seconds = generateSeconds + payoffSeconds;
+	std::cout << numAssets << " assets, " << numPaths << " paths: basket call " << std::exp(-rate * expiry) * total / numPaths
+		<< ", " << seconds * 1e3 << " ms (" << seconds * 1e9 / (double(numPaths) * numAssets) << " ns per asset path, "
+		<< 100 * generateSeconds / seconds << "% generating)" << std::endl;
 }
 
+
 // Using templates to calculate factorials
 /* Template-based computation can be seen as a useful strategy to reduce the 
 runtime overhead of numeric algorithms. After all, if youre able to perform some of the 
@@ -544,6 +1319,104 @@ void printRatios()
 		<< " denominator: " << one_third.den;
 }
 
+// Hazard rate curves
+// the market quotes a CDS by its par spread, the running premium that makes the contract worth zero today
+// default is modelled with a hazard rate lambda(t): the probability of surviving to t is Q(t) = exp(-integral of lambda)
+// we take lambda constant between quoted tenors and bootstrap it tenor by tenor, each par spread fixes one more segment
+// both legs are sums over a quarterly grid, with D(t) = exp(-r t) the risk-free discount factor:
+//   premium leg  = spread * sum of dt * D(t_k) * (Q(t_k-1) + Q(t_k)) / 2   (the risky annuity, with half a period accrued on default)
+//   protection   = (1 - R) * sum of D(t_k) * (Q(t_k-1) - Q(t_k))
+// the curve caches Q and D on the grid and keeps both sums as prefix sums, so any contract on the name, whatever its maturity,
+// is valued with two array lookups. Contracts share one curve through a shared_ptr
+
+class HazardCurve
+{
+public:
+	static constexpr double kStep = 0.25;  // quarterly grid, in years
+	static constexpr int kMaxSteps = 120;  // 30 years, the last hazard rate is held flat beyond the last tenor
+
+	HazardCurve(const std::vector<double>& tenors, const std::vector<double>& parSpreads, double recovery, double riskFreeRate);
+	HazardCurve shifted(double spreadShift) const;  // the same curve rebuilt with every par spread moved by spreadShift
+
+	double recovery() const { return m_recovery; }
+	double survival(int step) const { return m_survival[step]; }
+	double riskyAnnuity(int step) const { return m_annuity[step]; }
+	double protectionLeg(int step) const { return m_protection[step]; }  // per unit of loss given default
+	double hazardRate(int segment) const { return m_hazards[segment]; }
+
+private:
+	std::vector<double> m_tenors;
+	std::vector<double> m_parSpreads;
+	double m_recovery;
+	double m_rate;
+	std::vector<double> m_hazards;
+	std::vector<double> m_survival;    // Q(t_k), k = 0..kMaxSteps
+	std::vector<double> m_discount;    // D(t_k)
+	std::vector<double> m_annuity;     // prefix sums of the premium leg per unit of spread
+	std::vector<double> m_protection;  // prefix sums of the protection leg per unit of loss
+
+	void fillSegment(int first, int last, double hazard);
+};
+
+HazardCurve::HazardCurve(const std::vector<double>& tenors, const std::vector<double>& parSpreads, double recovery, double riskFreeRate)
+	: m_tenors(tenors), m_parSpreads(parSpreads), m_recovery(recovery), m_rate(riskFreeRate),
+	m_survival(kMaxSteps + 1), m_discount(kMaxSteps + 1), m_annuity(kMaxSteps + 1), m_protection(kMaxSteps + 1)
+{
+	if (m_tenors.size() != m_parSpreads.size())
+	{
+		throw std::runtime_error("hazard curve needs one par spread per tenor");
+	}
+	for (int k = 0; k <= kMaxSteps; ++k)
+	{
+		m_discount[k] = std::exp(-m_rate * k * kStep);
+	}
+	m_survival[0] = 1;
+
+	int first = 0;
+	for (std::size_t j = 0; j < m_tenors.size(); ++j)
+	{
+		int last = std::min(kMaxSteps, int(std::lround(m_tenors[j] / kStep)));
+		if (last <= first)
+		{
+			throw std::runtime_error("hazard curve tenors must be increasing multiples of a quarter");
+		}
+		// the value to the protection buyer rises with the hazard rate, so bisect until the contract is at par
+		double low = 0, high = 10;
+		for (int i = 0; i < 60; ++i)
+		{
+			double hazard = 0.5 * (low + high);
+			fillSegment(first, last, hazard);
+			double value = (1 - m_recovery) * m_protection[last] - m_parSpreads[j] * m_annuity[last];
+			(value > 0 ? high : low) = hazard;
+		}
+		m_hazards.push_back(0.5 * (low + high));
+		fillSegment(first, last, m_hazards.back());
+		first = last;
+	}
+	fillSegment(first, kMaxSteps, m_hazards.empty() ? 0 : m_hazards.back());
+}
+
+void HazardCurve::fillSegment(int first, int last, double hazard)
+{
+	double stepSurvival = std::exp(-hazard * kStep);
+	for (int k = first + 1; k <= last; ++k)
+	{
+		m_survival[k] = m_survival[k - 1] * stepSurvival;
+		m_annuity[k] = m_annuity[k - 1] + kStep * m_discount[k] * 0.5 * (m_survival[k - 1] + m_survival[k]);
+		m_protection[k] = m_protection[k - 1] + m_discount[k] * (m_survival[k - 1] - m_survival[k]);
+	}
+}
+
+HazardCurve HazardCurve::shifted(double spreadShift) const
+{
+	std::vector<double> spreads(m_parSpreads);
+	for (double& spread : spreads)
+	{
+		spread += spreadShift;
+	}
+	return HazardCurve(m_tenors, spreads, m_recovery, m_rate);
+}
+
 // encapsulation means hiding data, which becomes the member varoables of the target class
 // consider a credit default swap
 enum CDSUnderlying {
@@ -561,33 +1434,207 @@ public:
 	void setCounterpart(const std::string& s); //{ m_counterpart = s; }  // any changes happening to m_counterpart and m_payoff will only occur through an operation on CDSContract
 	double payoff() { return m_payoff; }
 	void setPayoff(double payoff) { m_payoff = payoff; }
-	virtual double computeCurrentValue(const Date& d);
+	void setTerm(const Date& start, int years, double spreadCost);  // the contract runs for years from start, paying spreadCost a year
+	void setCurve(std::shared_ptr<const HazardCurve> curve) { m_curve = curve; }
+	const HazardCurve* curve() const { return m_curve.get(); }
+	virtual double computeCurrentValue(const Date& d);  // value to the protection buyer on date d
+	virtual double valueOnCurve(const HazardCurve& curve, const Date& d) const;  // same, but on any curve for the name
+
+protected:
+	double legValue(const HazardCurve& curve, const Date& d, double recovery) const;
 
 private:
 	std::string m_counterpart;
 	CDSUnderlying m_underlying;
-	double m_payoff;
-	int m_term;
-	double m_spreadCost;
+	double m_payoff;      // notional paid out (less recovery) on default
+	int m_term;           // in years
+	double m_spreadCost;  // running premium, per year
+	int m_maturity;       // Date serial
+	std::shared_ptr<const HazardCurve> m_curve;
 
 	const static double kStandardPayoff; // made static because its the same for all members of the class
 };
 
+const double CDSContract::kStandardPayoff = 10'000'000;
+
+CDSContract::CDSContract() : m_underlying(CDSUnderlyingBond), m_payoff(kStandardPayoff), m_term(0), m_spreadCost(0), m_maturity(0)
+{
+
+}
+
+CDSContract::CDSContract(const CDSContract& p) : m_counterpart(p.m_counterpart), m_underlying(p.m_underlying), m_payoff(p.m_payoff),
+	m_term(p.m_term), m_spreadCost(p.m_spreadCost), m_maturity(p.m_maturity), m_curve(p.m_curve)
+{
+
+}
+
+CDSContract::~CDSContract()
+{
+
+}
+
+CDSContract& CDSContract::operator= (const CDSContract& p)
+{
+	if (this != &p)
+	{
+		m_counterpart = p.m_counterpart;
+		m_underlying = p.m_underlying;
+		m_payoff = p.m_payoff;
+		m_term = p.m_term;
+		m_spreadCost = p.m_spreadCost;
+		m_maturity = p.m_maturity;
+		m_curve = p.m_curve;
+	}
+	return *this;
+}
+
 void CDSContract::setCounterpart(const std::string& s)
 {
 	m_counterpart = s;
 	setPayoff(kStandardPayoff);
 }
 
+void CDSContract::setTerm(const Date& start, int years, double spreadCost)
+{
+	m_term = years;
+	m_spreadCost = spreadCost;
+	m_maturity = start.addMonths(12 * years).serial();
+}
+
+double CDSContract::legValue(const HazardCurve& curve, const Date& d, double recovery) const
+{
+	// the curve's time 0 is the valuation date, the remaining life is rounded to the quarterly grid
+	int steps = int(std::lround((m_maturity - d.serial()) / 365.25 / HazardCurve::kStep));
+	steps = std::clamp(steps, 0, HazardCurve::kMaxSteps);
+	return m_payoff * ((1 - recovery) * curve.protectionLeg(steps) - m_spreadCost * curve.riskyAnnuity(steps));
+}
+
+double CDSContract::valueOnCurve(const HazardCurve& curve, const Date& d) const
+{
+	return legValue(curve, d, curve.recovery());
+}
+
+double CDSContract::computeCurrentValue(const Date& d)
+{
+	return m_curve ? valueOnCurve(*m_curve, d) : 0;
+}
+
 class LoanOnlyCDSContract : public CDSContract
 {
 public:
+	LoanOnlyCDSContract();
 	void changeLoanSource(const std::string& s);
+	void setLoanRecovery(double recovery) { m_loanRecovery = recovery; }
 	virtual double computeCurrentValue(const Date& d);
+	virtual double valueOnCurve(const HazardCurve& curve, const Date& d) const;
 private:
 	std::string m_loanSource;
+	double m_loanRecovery;  // secured loans recover more than the bonds the curve was built from
 };
 
+LoanOnlyCDSContract::LoanOnlyCDSContract() : m_loanRecovery(0.7)
+{
+
+}
+
+void LoanOnlyCDSContract::changeLoanSource(const std::string& s)
+{
+	m_loanSource = s;
+}
+
+double LoanOnlyCDSContract::valueOnCurve(const HazardCurve& curve, const Date& d) const
+{
+	// the default probabilities still come from the name's curve, only the loss given default changes
+	return legValue(curve, d, m_loanRecovery);
+}
+
+double LoanOnlyCDSContract::computeCurrentValue(const Date& d)
+{
+	return curve() ? valueOnCurve(*curve(), d) : 0;
+}
+
+// reprice a whole book under a list of parallel par spread shocks, returning the book value in each scenario
+// contracts are grouped by the curve they point to, so each scenario rebuilds every distinct curve once and
+// all contracts on that name read the same cached legs. Scenarios are independent and are shared out across threads
+std::vector<double> revalueBook(const std::vector<const CDSContract*>& book, const Date& valuationDate, const std::vector<double>& spreadShocks,
+	unsigned numThreads = std::thread::hardware_concurrency())
+{
+	// a contract without a curve is worth 0 in every scenario, the same as computeCurrentValue, so it's given no curve index
+	std::vector<const HazardCurve*> curves;
+	std::vector<int> curveIndex(book.size(), -1);
+	for (std::size_t c = 0; c < book.size(); ++c)
+	{
+		if (!book[c]->curve()) continue;
+		auto found = std::find(curves.begin(), curves.end(), book[c]->curve());
+		curveIndex[c] = int(found - curves.begin());
+		if (found == curves.end()) curves.push_back(book[c]->curve());
+	}
+
+	std::vector<double> values(spreadShocks.size());
+	std::atomic<int> nextScenario(0);
+	auto worker = [&]() {
+		for (int s = nextScenario++; s < int(spreadShocks.size()); s = nextScenario++)
+		{
+			std::vector<HazardCurve> shocked;
+			shocked.reserve(curves.size());
+			for (const HazardCurve* curve : curves)
+			{
+				shocked.push_back(curve->shifted(spreadShocks[s]));
+			}
+			double total = 0;
+			for (std::size_t c = 0; c < book.size(); ++c)
+			{
+				if (curveIndex[c] >= 0) total += book[c]->valueOnCurve(shocked[curveIndex[c]], valuationDate);
+			}
+			values[s] = total;
+		}
+	};
+
+	numThreads = std::max(1u, std::min<unsigned>(numThreads, unsigned(spreadShocks.size())));
+	std::vector<std::thread> threads;
+	for (unsigned t = 1; t < numThreads; ++t)
+	{
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+	return values;
+}
+
+void benchmarkCDSBookRevaluation(int numNames, int contractsPerName, int numScenarios)
+{
+	Date today(2025, 3, 20);
+	std::vector<std::unique_ptr<CDSContract>> contracts;
+	std::vector<const CDSContract*> book;
+	for (int n = 0; n < numNames; ++n)
+	{
+		double level = 0.005 + 0.0002 * n;
+		auto curve = std::make_shared<const HazardCurve>(std::vector<double>{ 1, 3, 5, 7, 10 },
+			std::vector<double>{ level, level * 1.2, level * 1.35, level * 1.45, level * 1.5 }, 0.4, 0.03);
+		for (int c = 0; c < contractsPerName; ++c)
+		{
+			contracts.push_back(c % 4 == 3 ? std::make_unique<LoanOnlyCDSContract>() : std::make_unique<CDSContract>());
+			contracts.back()->setTerm(Date(2025, 3, 20).addMonths(-3 * (c % 8)), 1 + c % 10, level * 1.3);
+			contracts.back()->setCurve(curve);
+			book.push_back(contracts.back().get());
+		}
+	}
+	std::vector<double> shocks(numScenarios);
+	for (int s = 0; s < numScenarios; ++s)
+	{
+		shocks[s] = 0.000025 * (s - numScenarios / 2);  // quarter of a basis point steps either side of the base curve
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<double> values = revalueBook(book, today, shocks);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << book.size() << " contracts x " << numScenarios << " scenarios in " << seconds * 1e3 << " ms, book value "
+		<< values.front() << " at " << shocks.front() * 1e4 << "bp to " << values.back() << " at " << shocks.back() * 1e4 << "bp" << std::endl;
+}
+
 // Whenever the counterpart for the contract changes, the class reacts by resetting the 
 // payoff to a standard value(defined by the constant kStandardPayoff).That would not
 // be possible if the m_counterpart data member were not properly encapsulated into the CDSContract class
@@ -810,7 +1857,17 @@ int main()
 	ts.addValue(6.5);
 	ts.reducePrices(0.5);
 	std::cout << " price is " << ts.getFirstPriceLessThan(6.0) << std::endl;
-	/*
+	TimeSeriesPipeline pipeline;
+	pipeline.multiply(2).removeLessThan(8).add(-1);  // nothing runs until the pipeline is applied
+	ts.transform(pipeline);
+	std::cout << " after pipeline " << ts.prices().size() << " prices, first " << ts.prices().front() << std::endl;
+	std::stringstream history, filtered;
+	for (double price : vals)
+	{
+		history.write(reinterpret_cast<const char*>(&price), sizeof(price));
+	}
+	std::cout << " streamed " << pipeline.runStream(history, filtered, 4) << " prices through the pipeline" << std::endl;
+	benchmarkTimeSeriesPipeline(10'000'000);
 	Date myDate(2015, 1, 3);
 	auto dayOfWeek = myDate.getDayOfWeek();
 	std::cout << " day of week is "
@@ -820,7 +1877,48 @@ int main()
 	++secondDate;
 	int interval = myDate.daysInterval(secondDate);
 	std::cout << " interval is " << interval << " days" << std::endl;
-	*/
+
+	HolidayCalendar calendar;
+	calendar.addHoliday(Date(2015, 12, 25));
+	Date christmas = calendar.adjust(Date(2015, 12, 25), BusinessDayConvention::ModifiedFollowing);
+	std::cout << " 2015-12-25 adjusts to " << christmas.year() << "-" << christmas.month() << "-" << christmas.day() << std::endl;
+	PaymentSchedule schedule;
+	generateSchedule(Date(2015, 1, 30), Date(2016, 1, 30), 3, calendar, BusinessDayConvention::ModifiedFollowing,
+		DayCountConvention::Act360, schedule);
+	for (std::size_t i = 0; i < schedule.paymentDates.size(); ++i)
+	{
+		Date payment = Date::fromSerial(schedule.paymentDates[i]);
+		std::cout << " pay " << payment.year() << "-" << payment.month() << "-" << payment.day() << " accrual " << schedule.accrualFractions[i] << std::endl;
+	}
+	benchmarkSwapBookSchedules(100'000);
+
+	Matrix m1(2), m2(2), m3(2);
+	m1[0][0] = 1; m1[0][1] = 2; m1[1][0] = 3; m1[1][1] = 4;
+	m2[0][0] = 5; m2[1][1] = 5;
+	m3[0][1] = 1; m3[1][0] = 1;
+	Matrix fused = m1 + m2 - m3;  // one pass, no temporary for m1 + m2
+	Matrix product = m1 * m2;
+	std::cout << "trace(m1 + m2 - m3) = " << fused.trace() << " trace(m1 * m2) = " << product.trace() << std::endl;
+	benchmarkMatrixMultiply({ 64, 512, 2048 });
+
+	Matrix correlation(2);
+	correlation[0][0] = correlation[1][1] = 1;
+	correlation[0][1] = correlation[1][0] = 0.6;
+	Matrix cholesky = choleskyDecomposition(correlation);
+	std::cout << "cholesky L[1][0] = " << cholesky[1][0] << " L[1][1] = " << cholesky[1][1] << std::endl;
+	benchmarkBasketSimulation(1, 1'000'000, 0.5);
+	benchmarkBasketSimulation(50, 1'000'000, 0.5);
+
+	auto hazardCurve = std::make_shared<const HazardCurve>(std::vector<double>{ 1, 3, 5 }, std::vector<double>{ 0.01, 0.012, 0.014 }, 0.4, 0.03);
+	CDSContract cds;
+	cds.setTerm(Date(2025, 3, 20), 5, 0.014);
+	cds.setCurve(hazardCurve);
+	LoanOnlyCDSContract lcds;
+	lcds.setTerm(Date(2025, 3, 20), 5, 0.014);
+	lcds.setCurve(hazardCurve);
+	std::cout << "5y survival " << hazardCurve->survival(20) << " par cds value " << cds.computeCurrentValue(Date(2025, 3, 20))
+		<< " loan only cds value " << lcds.computeCurrentValue(Date(2025, 3, 20)) << std::endl;
+	benchmarkCDSBookRevaluation(100, 100, 500);
 	std::cout << "factorial(6) = " << Factorial<6>::result;
 	std::cout << "\n choiceNumber(5,6) = "  << ChoiceNumber<6, 2>::result;
 	showFactorial();
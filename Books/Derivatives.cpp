@@ -2,6 +2,27 @@
 # include <vector>
 # include <cmath>
 # include <string>
+# include <cstdint>
+# include <random>
+# include <algorithm>
+# include <span>
+# include <limits>
+# include <numbers>
+# include <thread>
+# include <atomic>
+# include <fstream>
+# include <chrono>
+# include <cstdio>
+# include <cstring>
+# include <type_traits>
+# include <cassert>
+# include <stdexcept>
+#if !defined(_WIN32)
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
 
 // Derivatives are contracts that have a price based on the properties of an underlying asset.
 // All derivatives that are traded in the market can be analyzed using a random walk model
@@ -64,6 +85,220 @@
 // classes of financial assets.For example, the price of a set of stocks can be analyzed as a
 // random walk, from which we can derive the probability of its change in the near future.
 
+// Random number generators for simulation
+// rand() keeps one hidden global state behind a lock in glibc, so every thread calling it queues up on the same lock
+// and the sequence each thread sees depends on how the threads happened to interleave, so runs can't be reproduced
+// instead each thread (or each path) owns its own generator object, and we make sure their streams never overlap
+// two kinds of generator are useful:
+// - xoshiro256++ keeps 256 bits of state and is one of the fastest good quality generators, jump() moves it 2^128 draws ahead in O(1)
+//   so thread k can start k jumps along and no two threads will ever produce overlapping numbers
+// - Philox4x32-10 is counter based, output number n is a pure function of (key, n), there is no state to carry between draws
+//   skipping to any point is O(1), and a loop filling a buffer has no dependency between iterations so it vectorises
+// both satisfy the UniformRandomBitGenerator requirements, so they plug straight into std::normal_distribution and friends
+
+// turns 64 random bits into a double in [0,1) using the top 53 bits
+inline double bitsToUniform(std::uint64_t bits)
+{
+	return static_cast<double>(bits >> 11) * (1.0 / 9007199254740992.0);
+}
+
+class Xoshiro256PlusPlus
+{
+public:
+	using result_type = std::uint64_t;
+
+	explicit Xoshiro256PlusPlus(std::uint64_t seed = 1);
+
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return ~result_type(0); }
+
+	result_type operator()();
+	void jump();  // equivalent to 2^128 calls of operator(), use it to hand out non overlapping streams to threads
+	void longJump();  // equivalent to 2^192 calls, e.g. one long jump per machine and then jump() per thread
+	Xoshiro256PlusPlus stream(unsigned index) const;  // a copy jumped index times
+
+	void fill(std::span<double> out);  // uniforms in [0,1)
+
+private:
+	void applyJump(const std::uint64_t (&polynomial)[4]);
+	static std::uint64_t rotl(std::uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+	std::uint64_t m_state[4];
+};
+
+Xoshiro256PlusPlus::Xoshiro256PlusPlus(std::uint64_t seed)
+{
+	// expand the seed with splitmix64, the state must not be all zero and nearby seeds should give unrelated states
+	for (std::uint64_t& word : m_state)
+	{
+		std::uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		word = z ^ (z >> 31);
+	}
+}
+
+inline Xoshiro256PlusPlus::result_type Xoshiro256PlusPlus::operator()()
+{
+	std::uint64_t result = rotl(m_state[0] + m_state[3], 23) + m_state[0];
+	std::uint64_t t = m_state[1] << 17;
+
+	m_state[2] ^= m_state[0];
+	m_state[3] ^= m_state[1];
+	m_state[1] ^= m_state[2];
+	m_state[0] ^= m_state[3];
+	m_state[2] ^= t;
+	m_state[3] = rotl(m_state[3], 45);
+
+	return result;
+}
+
+// jumping multiplies the state by a fixed power of the transition matrix, encoded as a polynomial, which costs 256 steps however far we jump
+void Xoshiro256PlusPlus::applyJump(const std::uint64_t (&polynomial)[4])
+{
+	std::uint64_t s[4] = { 0, 0, 0, 0 };
+	for (std::uint64_t word : polynomial)
+	{
+		for (int b = 0; b < 64; ++b)
+		{
+			if (word & (std::uint64_t(1) << b))
+			{
+				for (int i = 0; i < 4; ++i) s[i] ^= m_state[i];
+			}
+			(*this)();
+		}
+	}
+	for (int i = 0; i < 4; ++i) m_state[i] = s[i];
+}
+
+void Xoshiro256PlusPlus::jump()
+{
+	static const std::uint64_t polynomial[4] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+	applyJump(polynomial);
+}
+
+void Xoshiro256PlusPlus::longJump()
+{
+	static const std::uint64_t polynomial[4] = { 0x76e15d3efefdcbbfULL, 0xc5004e441c522fb3ULL, 0x77710069854ee241ULL, 0x39109bb02acbe635ULL };
+	applyJump(polynomial);
+}
+
+Xoshiro256PlusPlus Xoshiro256PlusPlus::stream(unsigned index) const
+{
+	Xoshiro256PlusPlus copy(*this);
+	for (unsigned i = 0; i < index; ++i) copy.jump();
+	return copy;
+}
+
+void Xoshiro256PlusPlus::fill(std::span<double> out)
+{
+	for (double& u : out)
+	{
+		u = bitsToUniform((*this)());
+	}
+}
+
+class Philox4x32
+{
+public:
+	using result_type = std::uint32_t;
+
+	// the key picks the sequence, stream is the upper half of the counter so different streams never meet
+	explicit Philox4x32(std::uint64_t seed = 1, std::uint64_t stream = 0);
+
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return ~result_type(0); }
+
+	result_type operator()();
+	void discard(std::uint64_t n);  // skip n outputs in O(1)
+	void fill(std::span<double> out);  // uniforms in [0,1), each counter value gives two doubles
+
+	// the whole generator, four 32 bit outputs for counter value (counter, stream) under key
+	static void block(std::uint64_t counter, std::uint64_t stream, std::uint64_t key, std::uint32_t (&out)[4]);
+
+private:
+	std::uint64_t m_key;
+	std::uint64_t m_stream;
+	std::uint64_t m_counter;  // next counter value to encrypt
+	std::uint32_t m_buffer[4];
+	unsigned m_used;  // outputs of m_buffer already handed out, 4 means the buffer is empty
+};
+
+Philox4x32::Philox4x32(std::uint64_t seed, std::uint64_t stream) : m_key(seed), m_stream(stream), m_counter(0), m_buffer{}, m_used(4)
+{
+}
+
+// ten rounds of multiply, swap and xor with the key, the key is bumped by the Weyl constants every round
+inline void Philox4x32::block(std::uint64_t counter, std::uint64_t stream, std::uint64_t key, std::uint32_t (&out)[4])
+{
+	std::uint32_t c0 = static_cast<std::uint32_t>(counter), c1 = static_cast<std::uint32_t>(counter >> 32);
+	std::uint32_t c2 = static_cast<std::uint32_t>(stream), c3 = static_cast<std::uint32_t>(stream >> 32);
+	std::uint32_t k0 = static_cast<std::uint32_t>(key), k1 = static_cast<std::uint32_t>(key >> 32);
+
+	for (int round = 0; round < 10; ++round)
+	{
+		std::uint64_t p0 = std::uint64_t(0xD2511F53u) * c0;
+		std::uint64_t p1 = std::uint64_t(0xCD9E8D57u) * c2;
+		std::uint32_t n0 = static_cast<std::uint32_t>(p1 >> 32) ^ c1 ^ k0;
+		std::uint32_t n2 = static_cast<std::uint32_t>(p0 >> 32) ^ c3 ^ k1;
+		c1 = static_cast<std::uint32_t>(p1);
+		c3 = static_cast<std::uint32_t>(p0);
+		c0 = n0;
+		c2 = n2;
+		k0 += 0x9E3779B9u;
+		k1 += 0xBB67AE85u;
+	}
+	out[0] = c0;
+	out[1] = c1;
+	out[2] = c2;
+	out[3] = c3;
+}
+
+inline Philox4x32::result_type Philox4x32::operator()()
+{
+	if (m_used == 4)
+	{
+		block(m_counter++, m_stream, m_key, m_buffer);
+		m_used = 0;
+	}
+	return m_buffer[m_used++];
+}
+
+void Philox4x32::discard(std::uint64_t n)
+{
+	// outputs consumed so far, a partly used buffer came from counter value m_counter - 1
+	std::uint64_t position = m_used == 4 ? m_counter * 4 : (m_counter - 1) * 4 + m_used;
+	position += n;
+	m_counter = position / 4;
+	m_used = 4;
+	if (position % 4 != 0)
+	{
+		block(m_counter++, m_stream, m_key, m_buffer);
+		m_used = static_cast<unsigned>(position % 4);
+	}
+}
+
+void Philox4x32::fill(std::span<double> out)
+{
+	// whole counter blocks straight into the output, every iteration is independent of the others
+	std::size_t pairs = out.size() / 2;
+	for (std::size_t i = 0; i < pairs; ++i)
+	{
+		std::uint32_t bits[4];
+		block(m_counter + i, m_stream, m_key, bits);
+		out[2 * i] = bitsToUniform((std::uint64_t(bits[0]) << 32) | bits[1]);
+		out[2 * i + 1] = bitsToUniform((std::uint64_t(bits[2]) << 32) | bits[3]);
+	}
+	m_counter += pairs;
+	m_used = 4;
+
+	if (out.size() % 2 != 0)
+	{
+		std::uint64_t high = (*this)(), low = (*this)();
+		out.back() = bitsToUniform((high << 32) | low);
+	}
+}
+
 // class that generates a random walk and stores the data in an std::vector
 // class uses a vector to hold the elements of the random walk so they can later be plotted
 
@@ -75,8 +310,12 @@ public:
 	RandomWalkGenerator& operator= (const RandomWalkGenerator& v);
 
 	std::vector<double> generateWalk();  // returns a vector with values of the random wlk
+	template <typename Rng>
+	void generateWalk(std::span<double> walk, Rng& rng);  // fills the caller's buffer, one step per element, using the caller's generator
 
 	double computeRandomStep(double currentPrice);  // returns a single step of the random walk
+	template <typename Rng>
+	double computeRandomStep(double currentPrice, Rng& rng);
 private:
 	int m_numSteps; 
 	double m_stepSize; // size of each step in percentage points
@@ -129,6 +368,15 @@ double RandomWalkGenerator::computeRandomStep(double currentPrice)
 	return val;
 }
 
+// same step, but drawing from a generator the caller owns so it is safe to use from many threads
+template <typename Rng>
+double RandomWalkGenerator::computeRandomStep(double currentPrice, Rng& rng)
+{
+	double u = bitsToUniform(static_cast<std::uint64_t>(rng()) << (64 - std::numeric_limits<typename Rng::result_type>::digits));
+	int r = static_cast<int>(u * 3);  // 1 in 3 chance of the price going up, staying same or going down
+	return currentPrice * (1.0 + m_stepSize * ((r == 0) - (r == 1)));
+}
+
 // generates numbers within the constraints set by the constructor
 std::vector<double> RandomWalkGenerator::generateWalk()
 {
@@ -144,367 +392,2253 @@ std::vector<double> RandomWalkGenerator::generateWalk()
 	return walk;
 }
 
+// fills the buffer with a walk of walk.size() steps, no allocation
+// all the uniforms are drawn in one bulk fill, then each one is turned into a +1 / -1 / 0 move without branching
+template <typename Rng>
+void RandomWalkGenerator::generateWalk(std::span<double> walk, Rng& rng)
+{
+	rng.fill(walk);
+
+	double prev = m_initialPrice;
+	for (double& val : walk)
+	{
+		int r = static_cast<int>(val * 3);
+		prev *= 1.0 + m_stepSize * ((r == 0) - (r == 1));
+		val = prev;
+	}
+}
+
 // this random walk simulates how a monteCarlo simulation can operate
 
-// moving averages calculation
-// given a particular equity investment, determine the simple moving average and the exponential moving average for a sequence of closing prices
-/* The moving average can be calculated using a simple average formula that is 
-repeated for each new period. Given prices p1, p2, ..., pN, the general formula for a 
-particular time period is given by
-MA = (1/N) (p1 + p2 + ... + pN) */
+// Quasi random path generation
+// the random walk above moves the price with rand() % 3, which is slow and converges badly
+// Monte Carlo error with pseudo random numbers falls like 1/sqrt(N), the points clump together and leave gaps by chance
+// low discrepancy (quasi random) sequences such as Sobol and Halton fill the unit hypercube evenly by construction
+// so the error falls closer to 1/N, we can get the same accuracy with far fewer paths
+
+// a path with n time steps needs n gaussians, i.e. one point in n dimensions
+// quasi random sequences are much better in their first few dimensions than their last ones
+// the Brownian bridge builds the path so that the first dimension fixes the terminal value, the second the midpoint and so on
+// so the dimensions that matter most for the price get the best coordinates of the sequence
+
+// primitive polynomials over GF(2), the Sobol sequence needs one per dimension
+// a polynomial is stored as the bits of its coefficients, e.g. x^3 + x + 1 is 0b1011
+// a degree s polynomial is primitive when x has order exactly 2^s - 1 modulo it, which we can test directly
+namespace gf2 {
+	inline std::uint64_t mulMod(std::uint64_t a, std::uint64_t b, std::uint64_t poly, int degree)
+	{
+		std::uint64_t result = 0;
+		while (b)
+		{
+			if (b & 1) result ^= a;
+			b >>= 1;
+			a <<= 1;
+			if (a >> degree & 1) a ^= poly;  // reduce as soon as a reaches the degree of poly
+		}
+		return result;
+	}
 
-// to calculate the moving average of a stock, we create a class that stores a sequence of prices in a vector
-// exponential moving average can also be calculated
-/*The main step of the EMA calculation is the addition of new values that are weighted 
-by the multiplier. The default multiplier r for EMA computation is given by
-P = 2/(N + 1)
-This multiplier gives greater weight to new values, thus making the EMA more 
-responsive to price changes than the simple moving average.*/
+	inline std::uint64_t powX(std::uint64_t e, std::uint64_t poly, int degree)
+	{
+		std::uint64_t result = 1, base = 2;  // base is the polynomial x
+		while (e)
+		{
+			if (e & 1) result = mulMod(result, base, poly, degree);
+			base = mulMod(base, base, poly, degree);
+			e >>= 1;
+		}
+		return result;
+	}
 
-class MACalculator
-{
-public:
-	MACalculator(int period);
-	MACalculator(const MACalculator& v);
-	MACalculator& operator= (const MACalculator& v);
-	~MACalculator();
+	inline bool isPrimitive(std::uint64_t poly, int degree)
+	{
+		std::uint64_t order = (std::uint64_t(1) << degree) - 1;
+		if (powX(order, poly, degree) != 1) return false;
 
-	void addPriceQuote(double close);
-	std::vector<double> calculateMA();
-	std::vector<double> calculateEMA();
-private:
-	int m_numPeriods; // number of periods used in the calculation
-	std::vector<double> prices;
-};
+		std::uint64_t rest = order;
+		for (std::uint64_t q = 2; q * q <= rest; ++q)  // x^(order / q) must not be 1 for any prime factor q of the order
+		{
+			if (rest % q != 0) continue;
+			if (powX(order / q, poly, degree) == 1) return false;
+			while (rest % q == 0) rest /= q;
+		}
+		return rest == 1 || powX(order / rest, poly, degree) != 1;
+	}
+}
 
-MACalculator::MACalculator(int period) : m_numPeriods(period)
+// returns the first count primitive polynomials, in order of degree and then value
+std::vector<std::uint32_t> primitivePolynomials(std::size_t count)
 {
-
+	std::vector<std::uint32_t> polys;
+	for (int degree = 1; polys.size() < count; ++degree)
+	{
+		for (std::uint32_t poly = (1u << degree) | 1u; poly < (2u << degree) && polys.size() < count; poly += 2)  // constant term must be 1
+		{
+			if (gf2::isPrimitive(poly, degree)) polys.push_back(poly);
+		}
+	}
+	return polys;
 }
 
-MACalculator::MACalculator(const MACalculator& v) : m_numPeriods(v.m_numPeriods)
+inline int polyDegree(std::uint32_t poly)
 {
+	int degree = 0;
+	while (poly >> (degree + 1)) ++degree;
+	return degree;
+}
 
+// Sobol sequence, Bratley and Fox construction with Antonov-Saleev gray code ordering
+// each new point is the previous one xor a single direction number, so a point costs one xor per dimension
+// the direction numbers come from the recurrence defined by each dimension's primitive polynomial
+// the recurrence needs s odd starting values m_1..m_s with m_k < 2^k, any choice gives a valid Sobol sequence
+// but the choice decides how uniform the two dimensional projections are, badly chosen values leave visible stripes
+// dimensions 2 to 64 use the Joe and Kuo values (new-joe-kuo-6.21201), whose polynomials are exactly the ones primitivePolynomials returns
+// further dimensions draw their starting values from a fixed seed, that keeps the sequence reproducible but their uniformity is not verified
+// generating them means there is no limit on the number of dimensions, 1000+ dimensions only need polynomials up to degree 13
+namespace joeKuo {
+	constexpr std::size_t kDimensions = 64;
+	constexpr int kMaxDegree = 9;
+
+	// starting values m_1..m_s for dimensions 2 to kDimensions, row d - 2 belongs to dimension d
+	constexpr std::uint32_t kInitialNumbers[kDimensions - 1][kMaxDegree] = {
+	{ 1 }, { 1, 3 }, { 1, 3, 1 }, { 1, 1, 1 }, { 1, 1, 3, 3 }, { 1, 3, 5, 13 },
+	{ 1, 1, 5, 5, 17 }, { 1, 1, 5, 5, 5 }, { 1, 1, 7, 11, 19 }, { 1, 1, 5, 1, 1 }, { 1, 1, 1, 3, 11 }, { 1, 3, 5, 5, 31 },
+	{ 1, 3, 3, 9, 7, 49 }, { 1, 1, 1, 15, 21, 21 }, { 1, 3, 1, 13, 27, 49 }, { 1, 1, 1, 15, 7, 5 }, { 1, 3, 1, 15, 13, 25 }, { 1, 1, 5, 5, 19, 61 },
+	{ 1, 3, 7, 11, 23, 15, 103 }, { 1, 3, 7, 13, 13, 15, 69 }, { 1, 1, 3, 13, 7, 35, 63 }, { 1, 3, 5, 9, 1, 25, 53 }, { 1, 3, 1, 13, 9, 35, 107 }, { 1, 3, 1, 5, 27, 61, 31 },
+	{ 1, 1, 5, 11, 19, 41, 61 }, { 1, 3, 5, 3, 3, 13, 69 }, { 1, 1, 7, 13, 1, 19, 1 }, { 1, 3, 7, 5, 13, 19, 59 }, { 1, 1, 3, 9, 25, 29, 41 }, { 1, 3, 5, 13, 23, 1, 55 },
+	{ 1, 3, 7, 3, 13, 59, 17 }, { 1, 3, 1, 3, 5, 53, 69 }, { 1, 1, 5, 5, 23, 33, 13 }, { 1, 1, 7, 7, 1, 61, 123 }, { 1, 1, 7, 9, 13, 61, 49 }, { 1, 3, 3, 5, 3, 55, 33 },
+	{ 1, 3, 1, 15, 31, 13, 49, 245 }, { 1, 3, 5, 15, 31, 59, 63, 97 }, { 1, 3, 1, 11, 11, 11, 77, 249 }, { 1, 3, 1, 11, 27, 43, 71, 9 }, { 1, 1, 7, 15, 21, 11, 81, 45 }, { 1, 3, 7, 3, 25, 31, 65, 79 },
+	{ 1, 3, 1, 1, 19, 11, 3, 205 }, { 1, 1, 5, 9, 19, 21, 29, 157 }, { 1, 3, 7, 11, 1, 33, 89, 185 }, { 1, 3, 3, 3, 15, 9, 79, 71 }, { 1, 3, 7, 11, 15, 39, 119, 27 }, { 1, 1, 3, 1, 11, 31, 97, 225 },
+	{ 1, 1, 1, 3, 23, 43, 57, 177 }, { 1, 3, 7, 7, 17, 17, 37, 71 }, { 1, 3, 1, 5, 27, 63, 123, 213 }, { 1, 1, 3, 5, 11, 43, 53, 133 }, { 1, 3, 5, 5, 29, 17, 47, 173, 479 }, { 1, 3, 3, 11, 3, 1, 109, 9, 69 },
+	{ 1, 1, 1, 5, 17, 39, 23, 5, 343 }, { 1, 3, 1, 5, 25, 15, 31, 103, 499 }, { 1, 1, 1, 11, 11, 17, 63, 105, 183 }, { 1, 1, 5, 11, 9, 29, 97, 231, 363 }, { 1, 1, 5, 15, 19, 45, 41, 7, 383 }, { 1, 3, 7, 7, 31, 19, 83, 137, 221 },
+	{ 1, 1, 1, 3, 23, 15, 111, 223, 83 }, { 1, 1, 5, 13, 31, 15, 55, 25, 161 }, { 1, 1, 3, 13, 25, 47, 39, 87, 257 },
+	};
 }
 
-MACalculator::~MACalculator()
+class SobolSequence
 {
+public:
+	static constexpr int kBits = 32;
 
-}
+	SobolSequence(std::size_t dimensions);
 
-MACalculator& MACalculator::operator= (const MACalculator& v)
+	std::size_t dimensions() const { return m_dimensions; }
+	void next(double* point);  // writes the next point, every coordinate in (0,1)
+	void skip(std::uint64_t n);  // jump ahead n points in O(dimensions * kBits)
+
+private:
+	std::size_t m_dimensions;
+	std::uint64_t m_index;
+	std::vector<std::uint32_t> m_directions;  // kBits direction numbers per dimension, dimension major
+	std::vector<std::uint32_t> m_state;
+};
+
+SobolSequence::SobolSequence(std::size_t dimensions)
+	: m_dimensions(dimensions), m_index(0), m_directions(dimensions * kBits), m_state(dimensions, 0)
 {
-	if (this != &v)
+	if (dimensions == 0)
 	{
-		m_numPeriods = v.m_numPeriods;
-		prices = v.prices;
+		return;
 	}
-	return *this;
-}
 
-std::vector<double> MACalculator::calculateMA()
-{
-	std::vector<double> ma;
-	double sum = 0;
-	for (int i = 0; i < prices.size(); ++i)
+	// the first dimension is the van der Corput sequence in base 2
+	for (int k = 0; k < kBits; ++k)
 	{
-		sum += prices[i];
-		if (i >= m_numPeriods)  // caluclate moving average for new prices after the limit has been hit
-		{
-			ma.push_back(sum / m_numPeriods);
-			sum -= prices[i - m_numPeriods];  // update sum so the first item over the sequence is removed
-		}
+		m_directions[k] = 1u << (kBits - 1 - k);
 	}
-	return ma;
-}
 
-std::vector<double> MACalculator::calculateEMA()
-{
-	std::vector<double> ema;
-	double sum = 0;
-	double multiplier = 2.0 / (m_numPeriods + 1);
-	for (int i = 0; i < prices.size(); ++i)
+	std::vector<std::uint32_t> polys = primitivePolynomials(dimensions > 1 ? dimensions - 1 : 0);
+	std::mt19937 initialNumbers(20240601u);
+
+	for (std::size_t d = 1; d < dimensions; ++d)
 	{
-		sum += prices[i];
-		if (i == m_numPeriods)
+		std::uint32_t poly = polys[d - 1];
+		int s = polyDegree(poly);
+		std::uint32_t* v = &m_directions[d * kBits];
+
+		for (int k = 0; k < s && k < kBits; ++k)
 		{
-			ema.push_back(sum / m_numPeriods);
-			sum -= prices[i - m_numPeriods];
+			std::uint32_t m = 0;
+			if (d < joeKuo::kDimensions) m = joeKuo::kInitialNumbers[d - 1][k];
+			else m = (initialNumbers() % (2u << k)) | 1u;  // m_(k+1) is odd and below 2^(k+1)
+			v[k] = m << (kBits - 1 - k);
 		}
-		else if (i > m_numPeriods)
+		for (int k = s; k < kBits; ++k)
 		{
-			double val = (1 - multiplier) * ema.back() + multiplier * prices[i];
-			ema.push_back(val);
+			v[k] = v[k - s] ^ (v[k - s] >> s);
+			for (int i = 1; i < s; ++i)
+			{
+				if (poly >> (s - i) & 1) v[k] ^= v[k - i];  // coefficient a_i of the polynomial
+			}
 		}
 	}
-
-	return ema;
 }
 
-void MACalculator::addPriceQuote(double close)
+void SobolSequence::next(double* point)
 {
-	prices.push_back(close);
+	// gray code: flip the direction number of the lowest zero bit of the index
+	int c = 0;
+	for (std::uint64_t i = m_index; i & 1; i >>= 1) ++c;
+	++m_index;
+
+	const std::uint32_t* v = &m_directions[c];
+	for (std::size_t d = 0; d < m_dimensions; ++d)
+	{
+		m_state[d] ^= v[d * kBits];
+		point[d] = (m_state[d] + 0.5) / 4294967296.0;  // midpoint of the cell, so 0 is never returned
+	}
 }
 
-// Calculating volatility of a particular equity instrument
-// volatility can be calculated useing max val - min val, or by finding the average of a range of values over a time period
-// or by using the statistical definition of standard deviation
+void SobolSequence::skip(std::uint64_t n)
+{
+	// the gray code point for index i is the xor of the direction numbers of the set bits of i ^ (i >> 1)
+	m_index += n;
+	std::uint64_t gray = m_index ^ (m_index >> 1);
+	for (std::size_t d = 0; d < m_dimensions; ++d)
+	{
+		std::uint32_t x = 0;
+		for (int k = 0; k < kBits; ++k)
+		{
+			if (gray >> k & 1) x ^= m_directions[d * kBits + k];
+		}
+		m_state[d] = x;
+	}
+}
 
-class VolatilityCalculator
+// Halton sequence, coordinate d is the radical inverse of the point index in the d-th prime base
+// simpler than Sobol but the high dimensions (large bases) are strongly correlated, so only use it for a few dozen dimensions
+class HaltonSequence
 {
 public:
-	VolatilityCalculator();
-	~VolatilityCalculator();
-	VolatilityCalculator(const VolatilityCalculator& v);
-	VolatilityCalculator& operator= (const VolatilityCalculator& v);
+	HaltonSequence(std::size_t dimensions);
 
-	void addPrice(double Price);
-	double rangeVolatility();
-	double stdDev();
-	double mean();
-	double avgDailyRange();
+	std::size_t dimensions() const { return m_bases.size(); }
+	void next(double* point);
+	void skip(std::uint64_t n) { m_index += n; }  // no state besides the index
 
 private:
-	std::vector<double> m_prices;
+	std::vector<std::uint32_t> m_bases;
+	std::uint64_t m_index;
 };
 
-VolatilityCalculator::VolatilityCalculator()
-{
-}
-VolatilityCalculator::~VolatilityCalculator()
+HaltonSequence::HaltonSequence(std::size_t dimensions) : m_index(0)
 {
+	for (std::uint32_t candidate = 2; m_bases.size() < dimensions; ++candidate)
+	{
+		bool prime = true;
+		for (std::uint32_t b : m_bases)
+		{
+			if (b * b > candidate) break;
+			if (candidate % b == 0) { prime = false; break; }
+		}
+		if (prime) m_bases.push_back(candidate);
+	}
 }
-VolatilityCalculator::VolatilityCalculator(const VolatilityCalculator& v)
-	: m_prices(v.m_prices)
+
+void HaltonSequence::next(double* point)
 {
+	++m_index;  // index 0 would give the point 0 in every dimension
+	for (std::size_t d = 0; d < m_bases.size(); ++d)
+	{
+		double inverseBase = 1.0 / m_bases[d], scale = inverseBase, value = 0.0;
+		for (std::uint64_t i = m_index; i > 0; i /= m_bases[d])
+		{
+			value += (i % m_bases[d]) * scale;  // mirror the base b digits of the index around the decimal point
+			scale *= inverseBase;
+		}
+		point[d] = value;
+	}
 }
-VolatilityCalculator& VolatilityCalculator::operator =(const
-	VolatilityCalculator& v)
+
+// inverse of the normal cdf, Acklam's rational approximation with relative error below 1.15e-9
+// Box Muller would mix pairs of coordinates and destroy the low discrepancy structure, so quasi random points are mapped one coordinate at a time
+inline double inverseNormalCdf(double p)
 {
-	if (&v != this)
+	static const double a[] = { -3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02, 1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00 };
+	static const double b[] = { -5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02, 6.680131188771972e+01, -1.328068155288572e+01 };
+	static const double c[] = { -7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00, -2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00 };
+	static const double d[] = { 7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00, 3.754408661907416e+00 };
+	constexpr double pLow = 0.02425;
+
+	if (p < pLow)
 	{
-		m_prices = v.m_prices;
+		double q = std::sqrt(-2.0 * std::log(p));
+		return (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) / ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1.0);
 	}
-	return *this;
+	if (p > 1.0 - pLow)
+	{
+		double q = std::sqrt(-2.0 * std::log(1.0 - p));
+		return -(((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) / ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1.0);
+	}
+	double q = p - 0.5;
+	double r = q * q;
+	return (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q / (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1.0);
 }
 
-void VolatilityCalculator::addPrice(double price)
+// a block of paths stored column major: all the paths' values at step k sit next to each other
+// so a payoff that looks at one time step at a time streams through contiguous memory, and loops over paths vectorise
+struct PathBlock
 {
-	m_prices.push_back(price);
-}
+	PathBlock(std::size_t steps, std::size_t paths) : numSteps(steps), numPaths(paths), values(steps * paths) {}
 
-double VolatilityCalculator::rangeVolatility()
+	double* step(std::size_t k) { return &values[k * numPaths]; }
+	const double* step(std::size_t k) const { return &values[k * numPaths]; }
+
+	std::size_t numSteps;
+	std::size_t numPaths;
+	std::vector<double> values;
+};
+
+// Brownian bridge on an evenly spaced time grid t_k = (k + 1) * T / n
+// the construction order, the two neighbouring points and the weights are all precomputed, building a path is then one pass of fused multiply adds
+class BrownianBridge
 {
-	if (m_prices.size() < 1)
+public:
+	BrownianBridge(std::size_t steps, double maturity);
+
+	// normals holds numSteps gaussians per path (dimension k in row k), paths receives W(t_k), both column major
+	void buildPaths(const PathBlock& normals, PathBlock& paths) const;
+
+private:
+	std::size_t m_steps;
+	std::vector<std::size_t> m_bridgeIndex, m_leftIndex, m_rightIndex;
+	std::vector<double> m_leftWeight, m_rightWeight, m_stdDev;
+};
+
+BrownianBridge::BrownianBridge(std::size_t steps, double maturity)
+	: m_steps(steps), m_bridgeIndex(steps), m_leftIndex(steps), m_rightIndex(steps), m_leftWeight(steps), m_rightWeight(steps), m_stdDev(steps)
+{
+	std::vector<double> t(steps);
+	for (std::size_t k = 0; k < steps; ++k)
 	{
-		return 0;
+		t[k] = (k + 1) * maturity / steps;
 	}
 
-	double min = m_prices[0];
-	double max = min;
-	for (int i = 1; i < m_prices.size(); ++i)
+	// map[k] != 0 once point k has been fixed, the first point fixed is the terminal one
+	std::vector<std::size_t> map(steps, 0);
+	map[steps - 1] = 1;
+	m_bridgeIndex[0] = steps - 1;
+	m_stdDev[0] = std::sqrt(t[steps - 1]);
+	m_leftWeight[0] = m_rightWeight[0] = 0.0;
+
+	for (std::size_t i = 1, j = 0; i < steps; ++i)
 	{
-		if (m_prices[i] < min)
+		// find the next unfixed run of points [j, k] and fix its midpoint
+		while (map[j]) ++j;
+		std::size_t k = j;
+		while (!map[k]) ++k;
+		std::size_t l = j + ((k - 1 - j) >> 1);
+		map[l] = i + 1;
+
+		m_bridgeIndex[i] = l;
+		m_leftIndex[i] = j;  // j == 0 means the left neighbour is W(0) = 0
+		m_rightIndex[i] = k;
+		double tLeft = j > 0 ? t[j - 1] : 0.0;
+		if (j > 0)
 		{
-			min = m_prices[i];
+			m_leftWeight[i] = (t[k] - t[l]) / (t[k] - tLeft);
+			m_rightWeight[i] = (t[l] - tLeft) / (t[k] - tLeft);
+			m_stdDev[i] = std::sqrt((t[l] - tLeft) * (t[k] - t[l]) / (t[k] - tLeft));
 		}
-		if (m_prices[i] > max)
+		else
 		{
-			max = m_prices[i];
+			m_leftWeight[i] = 0.0;
+			m_rightWeight[i] = t[l] / t[k];
+			m_stdDev[i] = std::sqrt(t[l] * (t[k] - t[l]) / t[k]);
 		}
-	}
 
-	return max - min;
+		j = k + 1;
+		if (j >= steps) j = 0;
+	}
 }
 
-double VolatilityCalculator::avgDailyRange()
+void BrownianBridge::buildPaths(const PathBlock& normals, PathBlock& paths) const
 {
-	unsigned long n = m_prices.size();
-	if (n < 2)
+	std::size_t numPaths = paths.numPaths;
+
 	{
-		return 0;
-	}
+		double* w = paths.step(m_steps - 1);
+		const double* z = normals.step(0);
+		for (std::size_t p = 0; p < numPaths; ++p)
+		{
+			w[p] = m_stdDev[0] * z[p];
+		}
+	}
+
+	for (std::size_t i = 1; i < m_steps; ++i)
+	{
+		double* w = paths.step(m_bridgeIndex[i]);
+		const double* right = paths.step(m_rightIndex[i]);
+		const double* z = normals.step(i);
+		double rightWeight = m_rightWeight[i], stdDev = m_stdDev[i];
+
+		if (m_leftIndex[i] > 0)
+		{
+			const double* left = paths.step(m_leftIndex[i] - 1);
+			double leftWeight = m_leftWeight[i];
+			for (std::size_t p = 0; p < numPaths; ++p)
+			{
+				w[p] = leftWeight * left[p] + rightWeight * right[p] + stdDev * z[p];
+			}
+		}
+		else
+		{
+			for (std::size_t p = 0; p < numPaths; ++p)
+			{
+				w[p] = rightWeight * right[p] + stdDev * z[p];
+			}
+		}
+	}
+}
+
+// geometric Brownian motion paths for Monte Carlo, driven by pseudo random, Sobol or Halton numbers
+enum class PathSource { PseudoRandom, Sobol, Halton };
+
+class GBMPathGenerator
+{
+public:
+	GBMPathGenerator(double spot, double rate, double vol, double maturity, std::size_t steps, PathSource source, std::uint64_t seed = 1);
+
+	// fills the next block of paths with spot values S(t_k), column major, block.numSteps must equal steps
+	void generate(PathBlock& block);
+
+private:
+	double m_spot, m_rate, m_vol, m_maturity;
+	std::size_t m_steps;
+	PathSource m_source;
+	BrownianBridge m_bridge;
+	SobolSequence m_sobol;
+	HaltonSequence m_halton;
+	std::mt19937_64 m_engine;
+	std::normal_distribution<double> m_normal;
+	std::vector<double> m_point;
+	PathBlock m_normals;  // reused between calls, only reallocated when the block size grows
+};
+
+GBMPathGenerator::GBMPathGenerator(double spot, double rate, double vol, double maturity, std::size_t steps, PathSource source, std::uint64_t seed)
+	: m_spot(spot), m_rate(rate), m_vol(vol), m_maturity(maturity), m_steps(steps), m_source(source), m_bridge(steps, maturity),
+	m_sobol(source == PathSource::Sobol ? steps : 0), m_halton(source == PathSource::Halton ? steps : 0), m_engine(seed), m_point(steps), m_normals(steps, 0)
+{
+}
+
+void GBMPathGenerator::generate(PathBlock& block)
+{
+	PathBlock& normals = m_normals;
+	normals.numPaths = block.numPaths;
+	normals.values.resize(m_steps * block.numPaths);  // keeps its capacity, so after the first block this never allocates
+
+	for (std::size_t p = 0; p < block.numPaths; ++p)
+	{
+		if (m_source == PathSource::PseudoRandom)
+		{
+			for (std::size_t k = 0; k < m_steps; ++k) m_point[k] = m_normal(m_engine);
+		}
+		else
+		{
+			if (m_source == PathSource::Sobol) m_sobol.next(m_point.data());
+			else m_halton.next(m_point.data());
+			for (std::size_t k = 0; k < m_steps; ++k) m_point[k] = inverseNormalCdf(m_point[k]);
+		}
+		for (std::size_t k = 0; k < m_steps; ++k)
+		{
+			normals.step(k)[p] = m_point[k];  // transpose into dimension major order
+		}
+	}
+
+	m_bridge.buildPaths(normals, block);
+
+	double drift = m_rate - 0.5 * m_vol * m_vol;
+	for (std::size_t k = 0; k < m_steps; ++k)
+	{
+		double t = (k + 1) * m_maturity / m_steps;
+		double* s = block.step(k);
+		for (std::size_t p = 0; p < block.numPaths; ++p)
+		{
+			s[p] = m_spot * std::exp(drift * t + m_vol * s[p]);
+		}
+	}
+}
+
+// convergence of Sobol + Brownian bridge against pseudo random paths
+// the test product is a geometric average Asian call, it depends on the whole path and has a closed form price
+void benchmarkQuasiRandomConvergence()
+{
+	const double spot = 100, strike = 100, rate = 0.05, vol = 0.2, maturity = 1.0;
+	const std::size_t steps = 64;
+
+	// log of the geometric average is normal, with mean and variance from the time grid
+	double meanTime = 0, covSum = 0;
+	for (std::size_t i = 1; i <= steps; ++i)
+	{
+		meanTime += i * maturity / steps;
+		for (std::size_t j = 1; j <= steps; ++j) covSum += std::min(i, j) * maturity / steps;
+	}
+	meanTime /= steps;
+	double mu = std::log(spot) + (rate - 0.5 * vol * vol) * meanTime;
+	double var = vol * vol * covSum / (steps * steps);
+	auto normCdf = [](double x) { return 0.5 * std::erfc(-x / std::sqrt(2.0)); };
+	double d1 = (mu - std::log(strike) + var) / std::sqrt(var);
+	double exact = std::exp(-rate * maturity) * (std::exp(mu + 0.5 * var) * normCdf(d1) - strike * normCdf(d1 - std::sqrt(var)));
+
+	auto price = [&](GBMPathGenerator& generator, std::size_t numPaths) {
+		PathBlock block(steps, numPaths);
+		generator.generate(block);
+		std::vector<double> logSum(numPaths, 0.0);
+		for (std::size_t k = 0; k < steps; ++k)
+		{
+			const double* s = block.step(k);
+			for (std::size_t p = 0; p < numPaths; ++p) logSum[p] += std::log(s[p]);
+		}
+		double sum = 0;
+		for (std::size_t p = 0; p < numPaths; ++p) sum += std::max(std::exp(logSum[p] / steps) - strike, 0.0);
+		return std::exp(-rate * maturity) * sum / numPaths;
+	};
+
+	std::cout << "geometric asian exact price " << exact << std::endl;
+	for (std::size_t numPaths : { 1024, 4096, 16384, 65536 })
+	{
+		const int seeds = 16;
+		double squaredError = 0;
+		for (int seed = 1; seed <= seeds; ++seed)
+		{
+			GBMPathGenerator pseudo(spot, rate, vol, maturity, steps, PathSource::PseudoRandom, seed);
+			double e = price(pseudo, numPaths) - exact;
+			squaredError += e * e;
+		}
+		GBMPathGenerator sobol(spot, rate, vol, maturity, steps, PathSource::Sobol);
+		std::cout << numPaths << " paths: pseudo random rms error " << std::sqrt(squaredError / seeds)
+			<< ", sobol + bridge error " << std::abs(price(sobol, numPaths) - exact) << std::endl;
+	}
+}
+
+// moving averages calculation
+// given a particular equity investment, determine the simple moving average and the exponential moving average for a sequence of closing prices
+/* The moving average can be calculated using a simple average formula that is 
+repeated for each new period. Given prices p1, p2, ..., pN, the general formula for a 
+particular time period is given by
+MA = (1/N) (p1 + p2 + ... + pN) */
+
+// to calculate the moving average of a stock, we create a class that stores a sequence of prices in a vector
+// exponential moving average can also be calculated
+/*The main step of the EMA calculation is the addition of new values that are weighted 
+by the multiplier. The default multiplier r for EMA computation is given by
+P = 2/(N + 1)
+This multiplier gives greater weight to new values, thus making the EMA more 
+responsive to price changes than the simple moving average.*/
+
+// every windowed calculator below sizes a ring buffer from its window or period and divides by it,
+// so a window of zero or less is rejected up front, in the member initialiser, before anything is allocated
+inline int checkedWindow(int window)
+{
+	if (window <= 0)
+	{
+		throw std::runtime_error("window must be positive");
+	}
+	return window;
+}
+
+// calculateMA and calculateEMA rescan the whole history and allocate a new vector every time they are called
+// when we need the latest average on every tick we keep running state instead, updated by addPriceQuote in O(1):
+// - the last m_numPeriods prices in a fixed size ring buffer, plus their running sum, so the SMA is sum / N
+// - the current EMA, seeded with the first full SMA and then updated with ema += P * (price - ema)
+// the latest values can then be read without allocating or scanning anything
+// pass keepHistory = false to stop storing every price, calculateMA and calculateEMA then have nothing to work on
+
+class MACalculator
+{
+public:
+	MACalculator(int period, bool keepHistory = true);
+	MACalculator(const MACalculator& v);
+	MACalculator& operator= (const MACalculator& v);
+	~MACalculator();
+
+	void addPriceQuote(double close);
+	std::vector<double> calculateMA();
+	std::vector<double> calculateEMA();
+
+	bool isReady() const { return m_count >= m_numPeriods; }  // a full period has been seen, before that the latest values are not meaningful
+	double latestMA() const { return m_windowSum / m_numPeriods; }
+	double latestEMA() const { return m_ema; }
+
+private:
+	int m_numPeriods; // number of periods used in the calculation
+	bool m_keepHistory;
+	std::vector<double> prices;
+
+	std::vector<double> m_window;  // ring buffer of the last m_numPeriods prices, sized once in the constructor
+	int m_head;  // slot the next price goes into, which also holds the oldest price once the window is full
+	long m_count;  // prices seen so far
+	double m_windowSum;
+	double m_ema;
+	double m_multiplier;
+};
+
+MACalculator::MACalculator(int period, bool keepHistory) : m_numPeriods(checkedWindow(period)), m_keepHistory(keepHistory), m_window(period, 0.0),
+	m_head(0), m_count(0), m_windowSum(0.0), m_ema(0.0), m_multiplier(2.0 / (period + 1))
+{
+
+}
+
+MACalculator::MACalculator(const MACalculator& v) : m_numPeriods(v.m_numPeriods), m_keepHistory(v.m_keepHistory), prices(v.prices), m_window(v.m_window),
+	m_head(v.m_head), m_count(v.m_count), m_windowSum(v.m_windowSum), m_ema(v.m_ema), m_multiplier(v.m_multiplier)
+{
+
+}
+
+MACalculator::~MACalculator()
+{
+
+}
+
+MACalculator& MACalculator::operator= (const MACalculator& v)
+{
+	if (this != &v)
+	{
+		m_numPeriods = v.m_numPeriods;
+		m_keepHistory = v.m_keepHistory;
+		prices = v.prices;
+		m_window = v.m_window;
+		m_head = v.m_head;
+		m_count = v.m_count;
+		m_windowSum = v.m_windowSum;
+		m_ema = v.m_ema;
+		m_multiplier = v.m_multiplier;
+	}
+	return *this;
+}
+
+std::vector<double> MACalculator::calculateMA()
+{
+	std::vector<double> ma;
+	double sum = 0;
+	for (int i = 0; i < prices.size(); ++i)
+	{
+		sum += prices[i];
+		if (i >= m_numPeriods - 1)  // caluclate moving average once the first full window (prices 0 to N - 1) has been summed
+		{
+			ma.push_back(sum / m_numPeriods);
+			sum -= prices[i - m_numPeriods + 1];  // update sum so the oldest price in the window is removed
+		}
+	}
+	return ma;
+}
+
+std::vector<double> MACalculator::calculateEMA()
+{
+	std::vector<double> ema;
+	double sum = 0;
+	double multiplier = 2.0 / (m_numPeriods + 1);
+	for (int i = 0; i < prices.size(); ++i)
+	{
+		sum += prices[i];
+		if (i == m_numPeriods - 1)  // the first EMA value is the SMA of the first full window
+		{
+			ema.push_back(sum / m_numPeriods);
+		}
+		else if (i > m_numPeriods - 1)
+		{
+			double val = (1 - multiplier) * ema.back() + multiplier * prices[i];
+			ema.push_back(val);
+		}
+	}
+
+	return ema;
+}
+
+void MACalculator::addPriceQuote(double close)
+{
+	if (m_keepHistory)
+	{
+		prices.push_back(close);
+	}
+
+	m_windowSum += close - m_window[m_head];  // the slot holds 0 until the window first fills up
+	m_window[m_head] = close;
+	++m_count;
+
+	if (m_count == m_numPeriods)
+	{
+		m_ema = m_windowSum / m_numPeriods;  // first EMA value is the SMA of the first period
+	}
+	else if (m_count > m_numPeriods)
+	{
+		m_ema += m_multiplier * (close - m_ema);
+	}
+
+	if (++m_head == m_numPeriods)
+	{
+		m_head = 0;
+		// adding and subtracting millions of prices lets rounding error build up in the running sum
+		// so resum the window once per lap, O(N) every N ticks is still O(1) per tick
+		double sum = 0.0;
+		for (double p : m_window)
+		{
+			sum += p;
+		}
+		m_windowSum = sum;
+	}
+}
+
+// the running values must match the batch functions on the same prices: after the first full window latestMA() is calculateMA().back()
+// and latestEMA() is calculateEMA().back(), up to rounding since the running sum is updated and resummed in a different order
+void checkMACalculator()
+{
+	const int period = 20;
+	MACalculator movingAverage(period);
+	std::mt19937 engine(11);
+	std::normal_distribution<double> change(0.0, 0.5);
+
+	double price = 100.0, firstWindowSum = 0.0, worstMA = 0.0, worstEMA = 0.0;
+	bool sizesMatch = true;
+	for (int i = 0; i < 2000; ++i)
+	{
+		price += change(engine);
+		movingAverage.addPriceQuote(price);
+		if (i < period) firstWindowSum += price;
+		if (!movingAverage.isReady()) continue;
+
+		std::vector<double> ma = movingAverage.calculateMA();
+		std::vector<double> ema = movingAverage.calculateEMA();
+		sizesMatch = sizesMatch && ma.size() == std::size_t(i - period + 2) && ema.size() == ma.size();  // one value per full window
+		worstMA = std::max(worstMA, std::abs(movingAverage.latestMA() - ma.back()));
+		worstEMA = std::max(worstEMA, std::abs(movingAverage.latestEMA() - ema.back()));
+		if (i == period - 1) worstMA = std::max(worstMA, std::abs(ma.front() - firstWindowSum / period));  // the first window is not skipped
+	}
+
+	bool ok = sizesMatch && worstMA < 1e-9 && worstEMA < 1e-9;
+	std::cout << "MACalculator running vs batch: " << (ok ? "match" : "MISMATCH") << ", max MA difference " << worstMA
+		<< ", max EMA difference " << worstEMA << std::endl;
+}
+
+// moving averages for thousands of symbols at once
+// the state for all symbols is stored as structure of arrays, one array each for the sums, SMAs and EMAs
+// and the ring buffer holds one row of prices per time slot, so row k is every symbol's price at that slot
+// all symbols tick together in a batch, so the head and count are shared and the update is one straight loop over the symbols
+// with no branches in the body, which the compiler vectorises
+
+class MultiSymbolMACalculator
+{
+public:
+	MultiSymbolMACalculator(std::size_t numSymbols, int period);
+
+	void addPriceQuotes(std::span<const double> closes);  // one close per symbol
+
+	bool isReady() const { return m_count >= m_numPeriods; }
+	double latestMA(std::size_t symbol) const { return m_mas[symbol]; }
+	double latestEMA(std::size_t symbol) const { return m_emas[symbol]; }
+	std::span<const double> latestMAs() const { return m_mas; }
+	std::span<const double> latestEMAs() const { return m_emas; }
+
+private:
+	std::size_t m_numSymbols;
+	int m_numPeriods;
+	double m_multiplier;
+	int m_head;
+	long m_count;
+	std::vector<double> m_window;  // m_numPeriods rows of m_numSymbols prices
+	std::vector<double> m_sums;
+	std::vector<double> m_mas;
+	std::vector<double> m_emas;
+};
+
+MultiSymbolMACalculator::MultiSymbolMACalculator(std::size_t numSymbols, int period) : m_numSymbols(numSymbols), m_numPeriods(checkedWindow(period)),
+	m_multiplier(2.0 / (period + 1)), m_head(0), m_count(0), m_window(numSymbols * period, 0.0), m_sums(numSymbols, 0.0),
+	m_mas(numSymbols, 0.0), m_emas(numSymbols, 0.0)
+{
+
+}
+
+void MultiSymbolMACalculator::addPriceQuotes(std::span<const double> closes)
+{
+	double* slot = &m_window[m_head * m_numSymbols];
+	double* sums = m_sums.data();
+	double* mas = m_mas.data();
+	double* emas = m_emas.data();
+	const double* close = closes.data();
+	double inverseN = 1.0 / m_numPeriods;
+	double multiplier = m_multiplier;
+
+	++m_count;
+	if (m_count > m_numPeriods)  // steady state, the branch is once per batch not once per symbol
+	{
+		for (std::size_t s = 0; s < m_numSymbols; ++s)
+		{
+			sums[s] += close[s] - slot[s];
+			slot[s] = close[s];
+			mas[s] = sums[s] * inverseN;
+			emas[s] += multiplier * (close[s] - emas[s]);
+		}
+	}
+	else
+	{
+		for (std::size_t s = 0; s < m_numSymbols; ++s)
+		{
+			sums[s] += close[s];
+			slot[s] = close[s];
+			mas[s] = sums[s] * inverseN;
+			emas[s] = mas[s];  // seeds the EMA with the SMA when the first period completes
+		}
+	}
+
+	if (++m_head == m_numPeriods)
+	{
+		m_head = 0;
+		// resum once per lap to stop rounding error building up, see MACalculator::addPriceQuote
+		std::fill(m_sums.begin(), m_sums.end(), 0.0);
+		for (int k = 0; k < m_numPeriods; ++k)
+		{
+			const double* row = &m_window[k * m_numSymbols];
+			for (std::size_t s = 0; s < m_numSymbols; ++s)
+			{
+				sums[s] += row[s];
+			}
+		}
+	}
+}
+
+// Calculating volatility of a particular equity instrument
+// volatility can be calculated useing max val - min val, or by finding the average of a range of values over a time period
+// or by using the statistical definition of standard deviation
+
+class VolatilityCalculator
+{
+public:
+	VolatilityCalculator();
+	~VolatilityCalculator();
+	VolatilityCalculator(const VolatilityCalculator& v);
+	VolatilityCalculator& operator= (const VolatilityCalculator& v);
+
+	void addPrice(double Price);
+	double rangeVolatility();
+	double stdDev();
+	double mean();
+	double avgDailyRange();
+
+private:
+	std::vector<double> m_prices;
+};
+
+VolatilityCalculator::VolatilityCalculator()
+{
+}
+VolatilityCalculator::~VolatilityCalculator()
+{
+}
+VolatilityCalculator::VolatilityCalculator(const VolatilityCalculator& v)
+	: m_prices(v.m_prices)
+{
+}
+VolatilityCalculator& VolatilityCalculator::operator =(const
+	VolatilityCalculator& v)
+{
+	if (&v != this)
+	{
+		m_prices = v.m_prices;
+	}
+	return *this;
+}
+
+void VolatilityCalculator::addPrice(double price)
+{
+	m_prices.push_back(price);
+}
+
+double VolatilityCalculator::rangeVolatility()
+{
+	if (m_prices.size() < 1)
+	{
+		return 0;
+	}
+
+	double min = m_prices[0];
+	double max = min;
+	for (int i = 1; i < m_prices.size(); ++i)
+	{
+		if (m_prices[i] < min)
+		{
+			min = m_prices[i];
+		}
+		if (m_prices[i] > max)
+		{
+			max = m_prices[i];
+		}
+	}
+
+	return max - min;
+}
+
+double VolatilityCalculator::avgDailyRange()
+{
+	unsigned long n = m_prices.size();
+	if (n < 2)
+	{
+		return 0;
+	}
 	double previous = m_prices[0];
 	double sum = 0;
-	for (int i = 1; i < m_prices.size(); ++i)
+	for (int i = 1; i < m_prices.size(); ++i)
+	{
+		double range = std::abs(m_prices[i] - previous);
+		sum += range;
+	}
+	return sum / n - 1;
+}
+
+double VolatilityCalculator::mean()
+{
+	double sum = 0;
+	for (int i = 0; i < m_prices.size(); ++i)
+	{
+		sum += m_prices[i];
+	}
+	return sum / m_prices.size();
+}
+
+// one pass with Welford's update (see WelfordAccumulator below) instead of calling mean() and then passing over the prices again
+double VolatilityCalculator::stdDev()
+{
+	double m = 0;
+	double sum = 0;
+	for (int i = 0; i < m_prices.size(); ++i)
+	{
+		double delta = m_prices[i] - m;
+		m += delta / (i + 1);
+		sum += delta * (m_prices[i] - m);
+	}
+	return std::sqrt(sum / (m_prices.size() - 1));
+}
+
+// Streaming volatility
+// VolatilityCalculator keeps every price forever and rescans all of them for each estimate
+// for live risk we want estimates that update in O(1) per price and only remember a bounded window
+// each estimator below is a small accumulator, StreamingVolatilityCalculator plugs them together
+// all of them work on log returns ln(P_t / P_t-1) rather than prices, which is what volatility usually means
+
+// Welford's algorithm, mean and variance in a single pass with no catastrophic cancellation
+// (the textbook sum(x^2) - n * mean^2 loses all its precision when the mean is large compared to the spread)
+class WelfordAccumulator
+{
+public:
+	void add(double x)
+	{
+		++m_count;
+		double delta = x - m_mean;
+		m_mean += delta / m_count;
+		m_m2 += delta * (x - m_mean);  // uses the mean before and after the update
+	}
+	long count() const { return m_count; }
+	double mean() const { return m_mean; }
+	double variance() const { return m_count > 1 ? m_m2 / (m_count - 1) : 0.0; }
+
+private:
+	long m_count = 0;
+	double m_mean = 0.0;
+	double m_m2 = 0.0;  // sum of squared deviations from the mean
+};
+
+// variance of the last N values, O(1) per update
+// once the window is full each new value replaces the oldest, and the mean and sum of squared deviations are updated for the swap
+class RollingVariance
+{
+public:
+	RollingVariance(int window) : m_window(checkedWindow(window), 0.0), m_head(0), m_count(0), m_mean(0.0), m_m2(0.0) {}
+
+	void add(double x)
+	{
+		if (m_count < static_cast<long>(m_window.size()))
+		{
+			++m_count;
+			double delta = x - m_mean;
+			m_mean += delta / m_count;
+			m_m2 += delta * (x - m_mean);
+		}
+		else
+		{
+			double oldest = m_window[m_head];
+			double oldMean = m_mean;
+			m_mean += (x - oldest) / m_count;
+			m_m2 += (x - oldest) * (x - m_mean + oldest - oldMean);
+			m_m2 = std::max(m_m2, 0.0);  // rounding can push it a hair below zero when the window is flat
+		}
+		m_window[m_head] = x;
+		if (++m_head == m_window.size())
+		{
+			m_head = 0;
+			recompute();  // once per lap, O(N) every N updates, stops rounding error from the swaps building up
+		}
+	}
+	long count() const { return m_count; }
+	double mean() const { return m_mean; }
+	double variance() const { return m_count > 1 ? m_m2 / (m_count - 1) : 0.0; }
+
+private:
+	void recompute()
+	{
+		double sum = 0.0;
+		for (double v : m_window) sum += v;
+		m_mean = sum / m_count;
+		m_m2 = 0.0;
+		for (double v : m_window) m_m2 += (v - m_mean) * (v - m_mean);
+	}
+
+	std::vector<double> m_window;
+	std::size_t m_head;
+	long m_count;
+	double m_mean;
+	double m_m2;
+};
+
+// running sum of the last N values, used by the range estimators below
+class RollingSum
+{
+public:
+	RollingSum(int window) : m_window(checkedWindow(window), 0.0), m_head(0), m_count(0), m_sum(0.0) {}
+
+	void add(double x)
+	{
+		m_sum += x - m_window[m_head];
+		m_window[m_head] = x;
+		m_count = std::min<long>(m_count + 1, m_window.size());
+		if (++m_head == m_window.size())
+		{
+			m_head = 0;
+			m_sum = 0.0;  // resum once per lap so rounding error can't build up
+			for (double v : m_window) m_sum += v;
+		}
+	}
+	long count() const { return m_count; }
+	double mean() const { return m_count > 0 ? m_sum / m_count : 0.0; }
+
+private:
+	std::vector<double> m_window;
+	std::size_t m_head;
+	long m_count;
+	double m_sum;
+};
+
+// open, high, low and close of one period
+struct OHLCBar
+{
+	double open;
+	double high;
+	double low;
+	double close;
+};
+
+// the range estimators use the high and low of each bar, not just the close
+// this uses far more of the price path, so they need far fewer bars for the same accuracy as close to close volatility
+// Parkinson:     var = 1 / (4 ln 2) * mean(ln(H / L)^2)
+// Garman-Klass:  var = mean(0.5 * ln(H / L)^2 - (2 ln 2 - 1) * ln(C / O)^2)
+// all the volatilities returned are per period, multiply by sqrt(periods per year) to annualise
+class StreamingVolatilityCalculator
+{
+public:
+	StreamingVolatilityCalculator(int window, double ewmaLambda = 0.94);  // 0.94 is the RiskMetrics daily decay factor, throws if window <= 0
+
+	void addPrice(double price);
+	void addBar(const OHLCBar& bar);  // also feeds the close into addPrice
+
+	double stdDev() const { return std::sqrt(m_allReturns.variance()); }  // every return seen so far
+	double rollingStdDev() const { return std::sqrt(m_rollingReturns.variance()); }  // the last window returns
+	double ewmaVolatility() const { return std::sqrt(m_ewmaVariance); }
+	double parkinsonVolatility() const;  // the last window bars
+	double garmanKlassVolatility() const;
+
+private:
+	double m_lambda;
+	double m_lastPrice;
+	bool m_hasPrice;
+	bool m_hasReturn;
+	double m_ewmaVariance;
+	WelfordAccumulator m_allReturns;
+	RollingVariance m_rollingReturns;
+	RollingSum m_parkinsonTerms;
+	RollingSum m_garmanKlassTerms;
+};
+
+StreamingVolatilityCalculator::StreamingVolatilityCalculator(int window, double ewmaLambda)
+	: m_lambda(ewmaLambda), m_lastPrice(0.0), m_hasPrice(false), m_hasReturn(false), m_ewmaVariance(0.0),
+	m_rollingReturns(window), m_parkinsonTerms(window), m_garmanKlassTerms(window)
+{
+}
+
+void StreamingVolatilityCalculator::addPrice(double price)
+{
+	if (m_hasPrice)
+	{
+		double r = std::log(price / m_lastPrice);
+		m_allReturns.add(r);
+		m_rollingReturns.add(r);
+		// RiskMetrics: var_t = lambda * var_t-1 + (1 - lambda) * r_t^2, seeded with the first squared return
+		m_ewmaVariance = m_hasReturn ? m_lambda * m_ewmaVariance + (1.0 - m_lambda) * r * r : r * r;
+		m_hasReturn = true;
+	}
+	m_lastPrice = price;
+	m_hasPrice = true;
+}
+
+void StreamingVolatilityCalculator::addBar(const OHLCBar& bar)
+{
+	double highLow = std::log(bar.high / bar.low);
+	double closeOpen = std::log(bar.close / bar.open);
+	m_parkinsonTerms.add(highLow * highLow);
+	m_garmanKlassTerms.add(0.5 * highLow * highLow - (2.0 * std::numbers::ln2 - 1.0) * closeOpen * closeOpen);
+	addPrice(bar.close);
+}
+
+double StreamingVolatilityCalculator::parkinsonVolatility() const
+{
+	return std::sqrt(m_parkinsonTerms.mean() / (4.0 * std::numbers::ln2));
+}
+
+double StreamingVolatilityCalculator::garmanKlassVolatility() const
+{
+	return std::sqrt(std::max(m_garmanKlassTerms.mean(), 0.0));
+}
+
+
+// Instrument correlation
+// given a sequence of closing prices for the last N periods, calculate the correlation between two equity instruments
+// two equities that are highly correlated (e.g. coke and pepsi) can use this property to accurately model thier prices
+
+// lets create two classes, a time series class for calculating values specific to a single time series, such as the average or standard deviation
+// the second class is the correlation calculator, which collects the data desired for the time series and computes the correlation
+
+class TimeSeries
+{
+public:
+	TimeSeries();
+	TimeSeries(const TimeSeries&);
+	~TimeSeries();
+	TimeSeries& operator= (const TimeSeries& v);
+
+	void addValue(double val);
+	double stdDev();
+	double mean();
+	size_t size() const;
+	double elem(int i) const;
+
+private:
+	std::vector<double> m_values;
+};
+
+TimeSeries::TimeSeries() : m_values()
+{
+
+}
+
+TimeSeries::~TimeSeries()
+{
+
+}
+
+TimeSeries::TimeSeries(const TimeSeries& v) : m_values(v.m_values)
+{
+
+}
+
+TimeSeries& TimeSeries::operator= (const TimeSeries& v)
+{
+	if (this != &v)
+	{
+		m_values = v.m_values;
+	}
+	return *this;
+}
+
+void TimeSeries::addValue(double val)
+{
+	m_values.push_back(val);
+}
+
+double TimeSeries::mean()
+{
+	double sum = 0;
+	for (int i = 0; i < m_values.size(); ++i)
+	{
+		sum += m_values[i];
+	}
+	return sum / m_values.size();
+}
+
+double TimeSeries::stdDev()
+{
+	double m = mean();
+	double sum = 0;
+	for (int i = 0; i < m_values.size(); ++i)
+	{
+		double val = m_values[i] - m;
+		sum += val * val;
+	}
+	return std::sqrt(sum / (m_values.size() - 1));
+}
+
+size_t TimeSeries::size() const
+{
+	return m_values.size();
+}
+
+double TimeSeries::elem(int pos) const
+{
+	return m_values[pos];
+}
+
+class CorrelationCalculator
+{
+public:
+	CorrelationCalculator(TimeSeries& a, TimeSeries& b);
+	~CorrelationCalculator();
+	CorrelationCalculator(const CorrelationCalculator& v);
+	CorrelationCalculator& operator= (const CorrelationCalculator& v);
+
+	double correlation();
+
+private:
+	TimeSeries& m_tsA;
+	TimeSeries& m_tsB;  // TimeSeries objects are members of the CorrelationCalculator
+};
+
+CorrelationCalculator::CorrelationCalculator(TimeSeries& a, TimeSeries& b) : m_tsA(a), m_tsB(b)
+{
+
+}
+
+CorrelationCalculator::~CorrelationCalculator()
+{
+}
+
+CorrelationCalculator::CorrelationCalculator(const CorrelationCalculator& c)
+	: m_tsA(c.m_tsA),
+	m_tsB(c.m_tsB)
+{
+}
+
+CorrelationCalculator& CorrelationCalculator::operator=(const
+	CorrelationCalculator& c)
+{
+	if (this != &c)
+	{
+		m_tsA = c.m_tsA;
+		m_tsB = c.m_tsB;
+	}
+	return *this;
+}
+
+double CorrelationCalculator::correlation()
+{
+	double sum = 0;
+	double meanA = m_tsA.mean();
+	double meanB = m_tsB.mean();
+
+	if (m_tsA.size() != m_tsB.size())
+	{
+		// there are a different number of observations so fail
+		return -1;
+	}
+
+	for (int i = 0; i < m_tsA.size(); ++i)
+	{
+		auto val = (m_tsA.elem(i) - meanA) * (m_tsB.elem(i) - meanB);
+		sum += val;
+	}
+
+	double stDevA = m_tsA.stdDev();
+	double stDevB = m_tsB.stdDev();
+	sum /= (stDevA * stDevB);
+	return sum / (m_tsB.size() - 1);
+}
+
+// Correlation matrix for a whole universe of instruments
+// CorrelationCalculator works on one pair at a time and passes over the data several times (mean, stdDev which calls mean again, then the products)
+// for N instruments that is N^2 / 2 pairs each reading both series from scratch
+// instead we put all the returns in one panel and compute the whole covariance matrix at once:
+// - the panel is column major, each instrument's returns are contiguous so a dot product between two instruments streams through memory
+// - subtract each column's mean once, then covariance(i, j) is the dot product of centred columns i and j divided by (T - 1)
+// - the matrix is computed in tiles of instruments, two tiles of columns fit in cache together so every column loaded is reused for a whole tile
+// - the tiles of the upper triangle are shared out between threads, each tile writes its own part of the matrix so no locking is needed
+// after that, a new row of returns is folded in with a rank-1 update in O(N^2) instead of recomputing everything in O(T N^2)
+
+class ReturnsPanel
+{
+public:
+	ReturnsPanel(std::size_t numObservations, std::size_t numInstruments)
+		: m_rows(numObservations), m_cols(numInstruments), m_data(numObservations * numInstruments, 0.0) {}
+
+	static ReturnsPanel fromTimeSeries(const std::vector<TimeSeries>& series);  // all series must have the same length
+
+	std::size_t observations() const { return m_rows; }
+	std::size_t instruments() const { return m_cols; }
+	double* column(std::size_t j) { return &m_data[j * m_rows]; }
+	const double* column(std::size_t j) const { return &m_data[j * m_rows]; }
+	double& operator() (std::size_t t, std::size_t j) { return m_data[j * m_rows + t]; }
+
+private:
+	std::size_t m_rows;
+	std::size_t m_cols;
+	std::vector<double> m_data;
+};
+
+ReturnsPanel ReturnsPanel::fromTimeSeries(const std::vector<TimeSeries>& series)
+{
+	std::size_t rows = series.empty() ? 0 : series[0].size();
+	ReturnsPanel panel(rows, series.size());
+	for (std::size_t j = 0; j < series.size(); ++j)
+	{
+		for (std::size_t t = 0; t < rows; ++t)
+		{
+			panel(t, j) = series[j].elem(static_cast<int>(t));
+		}
+	}
+	return panel;
+}
+
+class CorrelationMatrixEngine
+{
+public:
+	CorrelationMatrixEngine(std::size_t numInstruments);
+
+	void compute(const ReturnsPanel& panel, unsigned numThreads = std::thread::hardware_concurrency());  // full recompute
+	void addObservation(std::span<const double> returns, unsigned numThreads = 1);  // rank-1 update with one new row, returns.size() must be N
+
+	long observations() const { return m_count; }
+	bool isReady() const { return m_count >= 2; }  // a sample covariance needs two observations, before that the queries below have no value
+	double covariance(std::size_t i, std::size_t j) const;  // NaN until isReady()
+	double correlation(std::size_t i, std::size_t j) const;  // NaN until isReady()
+	std::vector<double> correlationMatrix() const;  // N x N, row major, empty until isReady()
+
+private:
+	static constexpr std::size_t kTile = 64;  // instruments per tile
+	static constexpr std::size_t kRowChunk = 512;  // observations per pass over a tile pair
+	static constexpr std::size_t kLanes = 4;  // independent partial sums per dot product
+
+	void computeTile(const std::vector<double>& centred, std::size_t rows, std::size_t tileI, std::size_t tileJ);
+
+	std::size_t m_n;
+	long m_count;
+	std::vector<double> m_means;
+	std::vector<double> m_comoments;  // sum over observations of (x_i - mean_i)(x_j - mean_j), N x N row major
+};
+
+CorrelationMatrixEngine::CorrelationMatrixEngine(std::size_t numInstruments)
+	: m_n(numInstruments), m_count(0), m_means(numInstruments, 0.0), m_comoments(numInstruments * numInstruments, 0.0)
+{
+}
+
+// one tile pair of the upper triangle, register blocked four columns of j at a time so each load of column i feeds four products
+// a dot product written as s += x[r] * y[r] is one long dependency chain, and the compiler may not reorder floating point adds
+// (that changes the rounding) unless told to with -ffast-math, so it neither vectorises it nor overlaps the adds
+// instead every product keeps kLanes partial sums, lane l takes rows r with r % kLanes == l, and they are only added together at the end
+// the lanes are independent, so with -O2 a lane loop becomes two SSE2 multiply adds (one with AVX2) and the adds of different lanes overlap
+// the result differs from the single chain sum only in rounding
+inline double sumLanes(const double* s)
+{
+	return (s[0] + s[2]) + (s[1] + s[3]);
+}
+
+void CorrelationMatrixEngine::computeTile(const std::vector<double>& centred, std::size_t rows, std::size_t tileI, std::size_t tileJ)
+{
+	static_assert(kLanes == 4, "sumLanes adds four lanes");
+	std::size_t iEnd = std::min(tileI + kTile, m_n);
+	std::size_t jEnd = std::min(tileJ + kTile, m_n);
+
+	for (std::size_t r0 = 0; r0 < rows; r0 += kRowChunk)
 	{
-		double range = std::abs(m_prices[i] - previous);
-		sum += range;
+		std::size_t r1 = std::min(r0 + kRowChunk, rows);
+		std::size_t rLanes = r0 + (r1 - r0) / kLanes * kLanes;  // rows [r0, rLanes) go through the lanes, the rest is the tail
+
+		for (std::size_t i = tileI; i < iEnd; ++i)
+		{
+			const double* xi = &centred[i * rows];
+			std::size_t jStart = (tileI == tileJ) ? i : tileJ;  // only the upper triangle on diagonal tiles
+			std::size_t j = jStart;
+
+			for (; j + 4 <= jEnd; j += 4)
+			{
+				const double* x0 = &centred[j * rows];
+				const double* x1 = x0 + rows;
+				const double* x2 = x1 + rows;
+				const double* x3 = x2 + rows;
+				double s0[kLanes] = {}, s1[kLanes] = {}, s2[kLanes] = {}, s3[kLanes] = {};
+				for (std::size_t r = r0; r < rLanes; r += kLanes)
+				{
+					// one lane loop per product, so each product's partial sums stay together in registers
+					for (std::size_t l = 0; l < kLanes; ++l) s0[l] += xi[r + l] * x0[r + l];
+					for (std::size_t l = 0; l < kLanes; ++l) s1[l] += xi[r + l] * x1[r + l];
+					for (std::size_t l = 0; l < kLanes; ++l) s2[l] += xi[r + l] * x2[r + l];
+					for (std::size_t l = 0; l < kLanes; ++l) s3[l] += xi[r + l] * x3[r + l];
+				}
+				for (std::size_t r = rLanes; r < r1; ++r)
+				{
+					double x = xi[r];
+					s0[0] += x * x0[r];
+					s1[0] += x * x1[r];
+					s2[0] += x * x2[r];
+					s3[0] += x * x3[r];
+				}
+				double* out = &m_comoments[i * m_n + j];
+				out[0] += sumLanes(s0);
+				out[1] += sumLanes(s1);
+				out[2] += sumLanes(s2);
+				out[3] += sumLanes(s3);
+			}
+			for (; j < jEnd; ++j)
+			{
+				const double* xj = &centred[j * rows];
+				double s[kLanes] = {};
+				for (std::size_t r = r0; r < rLanes; r += kLanes)
+				{
+					for (std::size_t l = 0; l < kLanes; ++l) s[l] += xi[r + l] * xj[r + l];
+				}
+				for (std::size_t r = rLanes; r < r1; ++r)
+				{
+					s[0] += xi[r] * xj[r];
+				}
+				m_comoments[i * m_n + j] += sumLanes(s);
+			}
+		}
 	}
-	return sum / n - 1;
 }
 
-double VolatilityCalculator::mean()
+void CorrelationMatrixEngine::compute(const ReturnsPanel& panel, unsigned numThreads)
 {
-	double sum = 0;
-	for (int i = 0; i < m_prices.size(); ++i)
+	std::size_t rows = panel.observations();
+	m_n = panel.instruments();
+	m_count = static_cast<long>(rows);
+	m_means.assign(m_n, 0.0);
+	m_comoments.assign(m_n * m_n, 0.0);
+
+	// centre every column once, same column major layout as the panel
+	std::vector<double> centred(rows * m_n);
+	for (std::size_t j = 0; j < m_n; ++j)
 	{
-		sum += m_prices[i];
+		const double* x = panel.column(j);
+		double sum = 0;
+		for (std::size_t t = 0; t < rows; ++t) sum += x[t];
+		double mean = rows > 0 ? sum / rows : 0.0;
+		m_means[j] = mean;
+		for (std::size_t t = 0; t < rows; ++t) centred[j * rows + t] = x[t] - mean;
+	}
+
+	std::vector<std::pair<std::size_t, std::size_t>> tiles;
+	for (std::size_t ti = 0; ti < m_n; ti += kTile)
+	{
+		for (std::size_t tj = ti; tj < m_n; tj += kTile)
+		{
+			tiles.emplace_back(ti, tj);
+		}
+	}
+
+	numThreads = std::max(1u, std::min<unsigned>(numThreads, static_cast<unsigned>(tiles.size())));
+	std::atomic<std::size_t> nextTile{ 0 };
+	auto worker = [&]() {
+		for (std::size_t k = nextTile++; k < tiles.size(); k = nextTile++)
+		{
+			computeTile(centred, rows, tiles[k].first, tiles[k].second);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned t = 1; t < numThreads; ++t) threads.emplace_back(worker);
+	worker();
+	for (std::thread& thread : threads) thread.join();
+
+	// mirror the upper triangle into the lower one
+	for (std::size_t i = 0; i < m_n; ++i)
+	{
+		for (std::size_t j = 0; j < i; ++j)
+		{
+			m_comoments[i * m_n + j] = m_comoments[j * m_n + i];
+		}
 	}
-	return sum / m_prices.size();
 }
 
-double VolatilityCalculator::stdDev()
+// multivariate Welford: with delta = x - old mean and delta2 = x - new mean, M_ij += delta_i * delta2_j
+// each row of the matrix is an independent axpy, so rows can be split between threads
+void CorrelationMatrixEngine::addObservation(std::span<const double> returns, unsigned numThreads)
 {
-	double m = mean();
-	double sum = 0;
-	for (int i = 0; i < m_prices.size(); ++i)
+	// a row for a different universe is a caller bug, a short one would read past its end, so it is dropped without touching the state
+	assert(returns.size() == m_n);
+	if (returns.size() != m_n) return;
+
+	++m_count;
+	std::vector<double> delta(m_n), delta2(m_n);
+	for (std::size_t i = 0; i < m_n; ++i)
 	{
-		double val = m_prices[i] - m;
-		sum += val * val;
+		delta[i] = returns[i] - m_means[i];
+		m_means[i] += delta[i] / m_count;
+		delta2[i] = returns[i] - m_means[i];
 	}
-	return std::sqrt(sum / (m_prices.size() - 1));
+
+	auto updateRows = [&](std::size_t begin, std::size_t end) {
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			double* row = &m_comoments[i * m_n];
+			double di = delta[i];
+			for (std::size_t j = 0; j < m_n; ++j)
+			{
+				row[j] += di * delta2[j];
+			}
+		}
+	};
+
+	numThreads = std::max(1u, numThreads);
+	std::vector<std::thread> threads;
+	for (unsigned t = 1; t < numThreads; ++t)
+	{
+		threads.emplace_back(updateRows, t * m_n / numThreads, (t + 1) * m_n / numThreads);
+	}
+	updateRows(0, m_n / numThreads);
+	for (std::thread& thread : threads) thread.join();
 }
 
-// Instrument correlation
-// given a sequence of closing prices for the last N periods, calculate the correlation between two equity instruments
-// two equities that are highly correlated (e.g. coke and pepsi) can use this property to accurately model thier prices
+double CorrelationMatrixEngine::covariance(std::size_t i, std::size_t j) const
+{
+	assert(isReady());
+	if (!isReady()) return std::numeric_limits<double>::quiet_NaN();  // with one observation this would divide by zero
+	return m_comoments[i * m_n + j] / (m_count - 1);
+}
 
-// lets create two classes, a time series class for calculating values specific to a single time series, such as the average or standard deviation
-// the second class is the correlation calculator, which collects the data desired for the time series and computes the correlation
+double CorrelationMatrixEngine::correlation(std::size_t i, std::size_t j) const
+{
+	assert(isReady());
+	if (!isReady()) return std::numeric_limits<double>::quiet_NaN();  // the co-moments are all 0 until then, 0 / 0
+	return m_comoments[i * m_n + j] / std::sqrt(m_comoments[i * m_n + i] * m_comoments[j * m_n + j]);
+}
 
-class TimeSeries
+std::vector<double> CorrelationMatrixEngine::correlationMatrix() const
 {
-public:
-	TimeSeries();
-	TimeSeries(const TimeSeries&);
-	~TimeSeries();
-	TimeSeries& operator= (const TimeSeries& v);
+	assert(isReady());
+	if (!isReady()) return {};
 
-	void addValue(double val);
-	double stdDev();
-	double mean();
-	size_t size();
-	double elem(int i);
+	std::vector<double> inverseStdDev(m_n);
+	for (std::size_t i = 0; i < m_n; ++i)
+	{
+		inverseStdDev[i] = 1.0 / std::sqrt(m_comoments[i * m_n + i]);
+	}
+
+	std::vector<double> correlations(m_n * m_n);
+	for (std::size_t i = 0; i < m_n; ++i)
+	{
+		for (std::size_t j = 0; j < m_n; ++j)
+		{
+			correlations[i * m_n + j] = m_comoments[i * m_n + j] * inverseStdDev[i] * inverseStdDev[j];
+		}
+	}
+	return correlations;
+}
+
+// Tick files
+// recorded market data is stored as a fixed layout binary file: a 64 byte header followed by 32 byte tick records
+// every field has a fixed size type and sits at its natural alignment, so the structs need no packing pragmas,
+// and the file can be mapped straight into memory (mmap) and used as an array of TickRecord with no parsing at all
+// the header carries a magic string, a format version and the record size, so a reader can refuse files it doesn't understand
+// the layout is little endian, the byte order of every mainstream platform
+
+enum class TickType : std::uint8_t { Trade, Bid, Ask };  // a trade, or a new best bid / best ask
+
+struct TickRecord
+{
+	std::uint64_t timestamp;  // nanoseconds since the epoch
+	std::uint64_t sequence;
+	double price;
+	std::uint32_t quantity;
+	std::uint16_t symbol;
+	TickType type;
+	std::uint8_t flags;
+};
+static_assert(sizeof(TickRecord) == 32, "TickRecord is part of the file format");
+static_assert(std::is_trivially_copyable_v<TickRecord>, "TickRecord is read straight from the mapped file");
+
+struct TickFileHeader
+{
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t recordSize;
+	std::uint64_t numTicks;
+	std::uint64_t firstTimestamp;
+	std::uint64_t lastTimestamp;
+	std::uint8_t reserved[24];
+};
+static_assert(sizeof(TickFileHeader) == 64, "TickFileHeader is part of the file format");
+
+constexpr char kTickFileMagic[8] = { 'T', 'I', 'C', 'K', 'F', 'I', 'L', 'E' };
+constexpr std::uint32_t kTickFileVersion = 1;
+
+// records are buffered and written with ofstream::write in large chunks, the header is rewritten with the final count on close
+class TickFileWriter
+{
+public:
+	TickFileWriter(const std::string& path);
+	~TickFileWriter() { close(); }
+	bool is_open() const { return m_file.is_open(); }
+	void write(const TickRecord& tick);
+	bool close();  // false if any write failed (disk full, bad path), in which case the file is incomplete
 
 private:
-	std::vector<double> m_values;
+	std::ofstream m_file;
+	TickFileHeader m_header;
+	std::vector<TickRecord> m_buffer;
+
+	void flushBuffer();
 };
 
-TimeSeries::TimeSeries() : m_values()
+TickFileWriter::TickFileWriter(const std::string& path) : m_file(path, std::ios::binary | std::ios::trunc), m_header()
 {
+	std::copy(std::begin(kTickFileMagic), std::end(kTickFileMagic), m_header.magic);
+	m_header.version = kTickFileVersion;
+	m_header.recordSize = sizeof(TickRecord);
+	m_buffer.reserve(1 << 15);
+	if (m_file.is_open())
+	{
+		m_file.write(reinterpret_cast<const char*>(&m_header), sizeof(m_header));  // placeholder until close
+	}
+}
 
+void TickFileWriter::write(const TickRecord& tick)
+{
+	if (m_header.numTicks == 0) m_header.firstTimestamp = tick.timestamp;
+	m_header.lastTimestamp = tick.timestamp;
+	m_header.numTicks++;
+	m_buffer.push_back(tick);
+	if (m_buffer.size() == m_buffer.capacity()) flushBuffer();
 }
 
-TimeSeries::~TimeSeries()
+void TickFileWriter::flushBuffer()
 {
+	m_file.write(reinterpret_cast<const char*>(m_buffer.data()), std::streamsize(m_buffer.size() * sizeof(TickRecord)));
+	m_buffer.clear();
+}
 
+bool TickFileWriter::close()
+{
+	if (!m_file.is_open()) return false;
+	flushBuffer();
+	m_file.seekp(0);
+	m_file.write(reinterpret_cast<const char*>(&m_header), sizeof(m_header));
+	m_file.close();  // the stream's failbit is sticky, so one check here covers every earlier write as well as the final flush
+	return !m_file.fail();
 }
 
-TimeSeries::TimeSeries(const TimeSeries& v) : m_values(v.m_values)
+// maps a tick file read only, ticks() is then a view straight onto the page cache
+// on Windows, where there is no mmap, the records are read into memory with a single read instead
+class TickFileReader
 {
+public:
+	TickFileReader() = default;
+	~TickFileReader() { close(); }
+	TickFileReader(const TickFileReader&) = delete;
+	TickFileReader& operator= (const TickFileReader&) = delete;
 
-}
+	bool open(const std::string& path);  // false if the file is missing, truncated or in a format we don't understand
+	void close();
+	const TickFileHeader& header() const { return m_header; }
+	std::span<const TickRecord> ticks() const { return m_ticks; }
 
-TimeSeries& TimeSeries::operator= (const TimeSeries& v)
+private:
+	TickFileHeader m_header{};
+	std::span<const TickRecord> m_ticks;
+#if defined(_WIN32)
+	std::vector<TickRecord> m_records;
+#else
+	void* m_mapping = nullptr;
+	std::size_t m_mappedBytes = 0;
+#endif
+};
+
+bool TickFileReader::open(const std::string& path)
 {
-	if (this != &v)
+	close();
+#if defined(_WIN32)
+	std::ifstream file(path, std::ios::binary);
+	if (!file.read(reinterpret_cast<char*>(&m_header), sizeof(m_header))) return false;
+	if (!std::equal(std::begin(kTickFileMagic), std::end(kTickFileMagic), m_header.magic)
+		|| m_header.version != kTickFileVersion || m_header.recordSize != sizeof(TickRecord)) return false;
+	m_records.resize(m_header.numTicks);
+	if (!file.read(reinterpret_cast<char*>(m_records.data()), std::streamsize(m_records.size() * sizeof(TickRecord)))) return false;
+	m_ticks = m_records;
+	return true;
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	struct stat info;
+	if (::fstat(fd, &info) != 0 || std::size_t(info.st_size) < sizeof(TickFileHeader))
 	{
-		m_values = v.m_values;
+		::close(fd);
+		return false;
 	}
-	return *this;
+	m_mappedBytes = std::size_t(info.st_size);
+	m_mapping = ::mmap(nullptr, m_mappedBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);  // the mapping keeps the file alive
+	if (m_mapping == MAP_FAILED)
+	{
+		m_mapping = nullptr;
+		return false;
+	}
+	::madvise(m_mapping, m_mappedBytes, MADV_SEQUENTIAL);  // replay reads front to back, so ask for aggressive read ahead
+
+	std::memcpy(&m_header, m_mapping, sizeof(m_header));
+	bool valid = std::equal(std::begin(kTickFileMagic), std::end(kTickFileMagic), m_header.magic)
+		&& m_header.version == kTickFileVersion && m_header.recordSize == sizeof(TickRecord)
+		&& m_header.numTicks <= (m_mappedBytes - sizeof(TickFileHeader)) / sizeof(TickRecord);
+	if (!valid)
+	{
+		close();
+		return false;
+	}
+	// the header is 64 bytes and mappings are page aligned, so the records are suitably aligned
+	const TickRecord* first = reinterpret_cast<const TickRecord*>(static_cast<const char*>(m_mapping) + sizeof(TickFileHeader));
+	m_ticks = std::span<const TickRecord>(first, m_header.numTicks);
+	return true;
+#endif
 }
 
-void TimeSeries::addValue(double val)
+void TickFileReader::close()
 {
-	m_values.push_back(val);
+	m_ticks = {};
+#if defined(_WIN32)
+	m_records.clear();
+#else
+	if (m_mapping != nullptr) ::munmap(m_mapping, m_mappedBytes);
+	m_mapping = nullptr;
+	m_mappedBytes = 0;
+#endif
 }
 
-double TimeSeries::mean()
+// Replaying ticks
+// the replay driver hands every tick to each consumer in turn, a consumer is anything callable with a const TickRecord&
+// consumers are template parameters rather than virtual functions, so each call can be inlined into the replay loop
+// in RecordedTimestamps mode the driver waits until each tick's offset from the first tick has passed on the wall clock,
+// sleeping for long gaps and spinning for the last stretch, which reproduces the original pacing of the feed
+// real feeds contain ticks that are slightly out of order, so pacing follows the latest timestamp seen so far, and a tick
+// stamped earlier than that is delivered straight away instead of being given a negative (wrapped around) delay
+
+enum class ReplaySpeed { AsFastAsPossible, RecordedTimestamps };
+
+template <typename... Consumers>
+void replayTicks(std::span<const TickRecord> ticks, ReplaySpeed speed, Consumers&... consumers)
 {
-	double sum = 0;
-	for (int i = 0; i < m_values.size(); ++i)
+	if (ticks.empty()) return;
+	const auto start = std::chrono::steady_clock::now();
+	const std::uint64_t firstTimestamp = ticks[0].timestamp;
+	std::uint64_t latestTimestamp = firstTimestamp;
+	for (const TickRecord& tick : ticks)
 	{
-		sum += m_values[i];
+		if (speed == ReplaySpeed::RecordedTimestamps)
+		{
+			latestTimestamp = std::max(latestTimestamp, tick.timestamp);
+			auto due = start + std::chrono::nanoseconds(latestTimestamp - firstTimestamp);
+			auto now = std::chrono::steady_clock::now();
+			if (due - now > std::chrono::microseconds(200)) std::this_thread::sleep_until(due - std::chrono::microseconds(100));
+			while (std::chrono::steady_clock::now() < due)
+			{
+			}
+		}
+		(consumers(tick), ...);
 	}
-	return sum / m_values.size();
 }
 
-double TimeSeries::stdDev()
+// consumer that keeps the top of the book from bid and ask ticks, the simplest order book a replay can drive
+struct TopOfBook
 {
-	double m = mean();
-	double sum = 0;
-	for (int i = 0; i < m_values.size(); ++i)
+	double bid = 0;
+	double ask = 0;
+	std::uint64_t updates = 0;
+	std::uint64_t crossed = 0;  // quotes where bid >= ask, a sign of bad data
+
+	void operator()(const TickRecord& tick)
 	{
-		double val = m_values[i] - m;
-		sum += val * val;
+		if (tick.type == TickType::Trade) return;
+		(tick.type == TickType::Bid ? bid : ask) = tick.price;
+		updates++;
+		crossed += (bid > 0 && ask > 0 && bid >= ask);
 	}
-	return std::sqrt(sum / (m_values.size() - 1));
+};
+
+// one symbol of synthetic ticks: a random walk mid price, a quote on each side every few trades, ticks 10 microseconds apart
+bool writeSyntheticTickFile(const std::string& path, std::size_t numTicks, std::uint64_t seed)
+{
+	TickFileWriter writer(path);
+	Xoshiro256PlusPlus rng(seed);
+	double mid = 100;
+	std::uint64_t timestamp = 1'700'000'000'000'000'000ULL;
+	for (std::size_t i = 0; i < numTicks; ++i)
+	{
+		double u = bitsToUniform(rng());
+		mid *= 1 + 0.0002 * (u - 0.5);
+		TickType type = TickType(i % 3);
+		double price = type == TickType::Bid ? mid - 0.01 : type == TickType::Ask ? mid + 0.01 : mid + 0.01 * (u < 0.5 ? -1 : 1);
+		writer.write({ timestamp, i, price, std::uint32_t(100 + rng() % 900), 0, type, 0 });
+		timestamp += 10'000;
+	}
+	return writer.close();
 }
 
-size_t TimeSeries::size()
+void benchmarkTickReplay(const std::string& path, std::size_t numTicks)
 {
-	return m_values.size();
+	auto start = std::chrono::steady_clock::now();
+	if (!writeSyntheticTickFile(path, numTicks, 99))
+	{
+		std::cout << "could not write " << path << std::endl;
+		return;
+	}
+	double writeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	TickFileReader reader;
+	if (!reader.open(path))
+	{
+		std::cout << "could not open " << path << std::endl;
+		return;
+	}
+	std::span<const TickRecord> ticks = reader.ticks();
+	double gigabytes = double(ticks.size_bytes()) / 1e9;
+
+	// a plain scan of the mapped records, the most the file can be consumed at
+	start = std::chrono::steady_clock::now();
+	double checksum = 0;
+	for (const TickRecord& tick : ticks)
+	{
+		checksum += tick.price;
+	}
+	double scanSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// a full replay into the pricing classes and a book
+	MACalculator movingAverage(20, false);
+	StreamingVolatilityCalculator volatility(100);
+	TopOfBook book;
+	auto trades = [&](const TickRecord& tick) {
+		if (tick.type != TickType::Trade) return;
+		movingAverage.addPriceQuote(tick.price);
+		volatility.addPrice(tick.price);
+	};
+	start = std::chrono::steady_clock::now();
+	replayTicks(ticks, ReplaySpeed::AsFastAsPossible, trades, book);
+	double replaySeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::cout << ticks.size() << " ticks (" << gigabytes * 1e3 << " MB): write " << gigabytes / writeSeconds << " GB/s, mapped scan "
+		<< gigabytes / scanSeconds << " GB/s (" << ticks.size() / scanSeconds << " ticks/s), replay " << gigabytes / replaySeconds << " GB/s ("
+		<< ticks.size() / replaySeconds << " ticks/s), checksum " << checksum << std::endl;
+	std::cout << "  last MA " << movingAverage.latestMA() << " EMA " << movingAverage.latestEMA() << " rolling vol " << volatility.rollingStdDev()
+		<< " book " << book.bid << " / " << book.ask << " crossed " << book.crossed << std::endl;
+	reader.close();
+	std::remove(path.c_str());
 }
 
-double TimeSeries::elem(int pos)
+// replays a short recording at its original pace, the 3000 ticks are 10 microseconds apart so this takes about 30ms
+void demoTickReplay(const std::string& path)
 {
-	return m_values[pos];
+	if (!writeSyntheticTickFile(path, 3000, 7))
+	{
+		std::cout << "could not write " << path << std::endl;
+		return;
+	}
+	TickFileReader reader;
+	if (!reader.open(path))
+	{
+		std::cout << "could not open " << path << std::endl;
+		return;
+	}
+	VolatilityCalculator volatility;
+	MACalculator movingAverage(20, false);
+	TopOfBook book;
+	auto trades = [&](const TickRecord& tick) {
+		if (tick.type != TickType::Trade) return;
+		volatility.addPrice(tick.price);
+		movingAverage.addPriceQuote(tick.price);
+	};
+	auto start = std::chrono::steady_clock::now();
+	replayTicks(reader.ticks(), ReplaySpeed::RecordedTimestamps, trades, book);
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "replayed " << reader.header().numTicks << " ticks spanning " << (reader.header().lastTimestamp - reader.header().firstTimestamp) / 1e6
+		<< "ms in " << elapsed * 1e3 << "ms: mean " << volatility.mean() << " std dev " << volatility.stdDev() << " MA " << movingAverage.latestMA()
+		<< " bid " << book.bid << " ask " << book.ask << std::endl;
+	reader.close();
+	std::remove(path.c_str());
 }
 
-class CorrelationCalculator
+// Finite difference pricing
+// the Black Scholes PDE  dV/dt + 0.5 sigma^2 S^2 d2V/dS2 + r S dV/dS - r V = 0  can be solved numerically on a grid of spot prices and times,
+// starting from the payoff at expiry and stepping back to today
+// with V_i = V(i dS) the derivatives in S become differences between neighbouring nodes, and one step back in time is
+//   (I - theta dt L) V(t) = (I + (1 - theta) dt L) V(t + dt)
+// where L is tridiagonal. theta = 0 gives the explicit scheme, theta = 1 the implicit scheme and theta = 0.5 Crank Nicolson
+// - explicit needs no solve, but it is only stable when dt < 1 / (sigma^2 M^2 + r), so fine grids need a huge number of steps
+// - implicit is stable for any dt but only first order accurate in time
+// - Crank Nicolson is stable and second order, but the kink in the payoff makes it ring, so the first steps are taken implicitly (Rannacher smoothing)
+// the tridiagonal matrix depends only on the grid, not on the strike or the time step, so the Thomas algorithm's elimination factors are computed once
+// every strike on the same grid shares them: values are stored with the strikes interleaved (node i of every strike side by side)
+// so each step of the Thomas sweep is a short loop over strikes that vectorises, and all buffers are allocated once per solve
+// American options add the constraint V >= payoff at every node, which makes each step a linear complementarity problem
+// projected SOR (PSOR) solves it with Gauss Seidel sweeps that clamp each node to the payoff as they go
+
+enum class PayoffType { Call, Put };
+enum class ExerciseStyle { European, American };
+enum class FDScheme { Explicit, Implicit, CrankNicolson };
+
+struct FDSettings
+{
+	double spotMax = 400;            // upper edge of the grid, a few times the largest strike
+	std::size_t numSpots = 200;      // grid intervals, the grid has numSpots + 1 nodes
+	std::size_t numSteps = 200;      // time steps, see stableExplicitSteps for the explicit scheme
+	FDScheme scheme = FDScheme::CrankNicolson;
+	std::size_t smoothingSteps = 2;  // implicit steps taken first by Crank Nicolson
+	double psorOmega = 1.2;          // over relaxation factor, between 1 and 2
+	double psorTolerance = 1e-9;     // largest change of any node in the last sweep
+	std::size_t maxPsorIterations = 1000;
+};
+
+// the fewest time steps that keep the explicit scheme stable on a grid of numSpots intervals
+std::size_t stableExplicitSteps(double rate, double vol, double maturity, std::size_t numSpots)
+{
+	double maxStep = 1.0 / (vol * vol * double(numSpots) * double(numSpots) + rate);
+	return static_cast<std::size_t>(std::ceil(maturity / maxStep));
+}
+
+class FiniteDifferencePricer
 {
 public:
-	CorrelationCalculator(TimeSeries& a, TimeSeries& b);
-	~CorrelationCalculator();
-	CorrelationCalculator(const CorrelationCalculator& v);
-	CorrelationCalculator& operator= (const CorrelationCalculator& v);
+	FiniteDifferencePricer(double rate, double vol, double maturity, const FDSettings& settings);
 
-	double correlation();
+	// rolls every strike back from expiry to today on the shared grid
+	void solve(std::span<const double> strikes, PayoffType payoff, ExerciseStyle exercise);
+	double value(double spot, std::size_t strikeIndex = 0) const;  // today's value, interpolated linearly between nodes
+	std::size_t psorIterations() const { return m_psorIterations; }  // summed over the time steps of the last solve
 
 private:
-	TimeSeries& m_tsA;
-	TimeSeries& m_tsB;  // TimeSeries objects are members of the CorrelationCalculator
+	double m_rate, m_vol, m_maturity;
+	FDSettings m_settings;
+	double m_dS;
+	std::size_t m_numStrikes = 0;
+
+	// dt L, row i is a_i V_{i-1} + b_i V_i + c_i V_{i+1}
+	std::vector<double> m_a, m_b, m_c;
+	// Thomas factors of I - theta dt L for the current theta
+	std::vector<double> m_factor, m_pivotInverse;
+	double m_factorTheta = -1;
+
+	// (numSpots + 1) x numStrikes, strikes interleaved
+	std::vector<double> m_values, m_rhs, m_payoff;
+	std::size_t m_psorIterations = 0;
+
+	void factorise(double theta);
+	void thomasSolve();  // interior of m_values from m_rhs
+	void psorSolve(double theta);
+	double* row(std::vector<double>& grid, std::size_t i) { return grid.data() + i * m_numStrikes; }
 };
 
-CorrelationCalculator::CorrelationCalculator(TimeSeries& a, TimeSeries& b) : m_tsA(a), m_tsB(b)
+FiniteDifferencePricer::FiniteDifferencePricer(double rate, double vol, double maturity, const FDSettings& settings)
+	: m_rate(rate), m_vol(vol), m_maturity(maturity), m_settings(settings), m_dS(settings.spotMax / settings.numSpots),
+	m_a(settings.numSpots + 1), m_b(settings.numSpots + 1), m_c(settings.numSpots + 1), m_factor(settings.numSpots + 1), m_pivotInverse(settings.numSpots + 1)
 {
+	const double dt = maturity / settings.numSteps;
+	for (std::size_t i = 1; i < settings.numSpots; ++i)
+	{
+		double diffusion = vol * vol * double(i) * double(i);
+		double drift = rate * double(i);
+		m_a[i] = 0.5 * dt * (diffusion - drift);
+		m_b[i] = -dt * (diffusion + rate);
+		m_c[i] = 0.5 * dt * (diffusion + drift);
+	}
+}
 
+// forward elimination of the constant matrix, done once instead of at every step
+void FiniteDifferencePricer::factorise(double theta)
+{
+	if (theta == m_factorTheta) return;
+	double previous = 0.0;
+	for (std::size_t i = 1; i < m_settings.numSpots; ++i)
+	{
+		double lower = -theta * m_a[i];
+		double pivot = 1.0 - theta * m_b[i] - lower * previous;
+		m_pivotInverse[i] = 1.0 / pivot;
+		m_factor[i] = -theta * m_c[i] * m_pivotInverse[i];
+		previous = m_factor[i];
+	}
+	m_factorTheta = theta;
 }
 
-CorrelationCalculator::~CorrelationCalculator()
+// forward elimination and back substitution, both in place in m_values so m_rhs stays intact for PSOR
+// rows 0 and numSpots of m_values hold the boundary values, which the sweeps pick up as the neighbours of the first and last unknowns
+void FiniteDifferencePricer::thomasSolve()
 {
+	const std::size_t last = m_settings.numSpots - 1;
+	const std::size_t n = m_numStrikes;
+	for (std::size_t i = 1; i <= last; ++i)
+	{
+		const double lower = -m_factorTheta * m_a[i];
+		const double inverse = m_pivotInverse[i];
+		const double* previous = row(m_values, i - 1);
+		const double* rhs = row(m_rhs, i);
+		double* current = row(m_values, i);
+		for (std::size_t k = 0; k < n; ++k)
+		{
+			current[k] = (rhs[k] - lower * previous[k]) * inverse;
+		}
+	}
+	for (std::size_t i = last; i >= 1; --i)
+	{
+		const double factor = m_factor[i];
+		const double* next = row(m_values, i + 1);
+		double* current = row(m_values, i);
+		for (std::size_t k = 0; k < n; ++k)
+		{
+			current[k] -= factor * next[k];
+		}
+	}
 }
 
-CorrelationCalculator::CorrelationCalculator(const CorrelationCalculator& c)
-	: m_tsA(c.m_tsA),
-	m_tsB(c.m_tsB)
+// starts from the unconstrained solution clamped to the payoff, which is usually only a few sweeps away from the answer
+void FiniteDifferencePricer::psorSolve(double theta)
 {
+	const std::size_t last = m_settings.numSpots - 1;
+	const std::size_t n = m_numStrikes;
+	const double omega = m_settings.psorOmega;
+	for (std::size_t i = 1; i <= last; ++i)
+	{
+		double* current = row(m_values, i);
+		const double* payoff = row(m_payoff, i);
+		for (std::size_t k = 0; k < n; ++k)
+		{
+			current[k] = std::max(current[k], payoff[k]);
+		}
+	}
+
+	for (std::size_t iteration = 0; iteration < m_settings.maxPsorIterations; ++iteration)
+	{
+		m_psorIterations++;
+		double maxChange = 0.0;
+		for (std::size_t i = 1; i <= last; ++i)
+		{
+			const double lower = -theta * m_a[i];
+			const double upper = -theta * m_c[i];
+			const double inverseDiagonal = 1.0 / (1.0 - theta * m_b[i]);
+			const double* previous = row(m_values, i - 1);
+			const double* next = row(m_values, i + 1);
+			const double* rhs = row(m_rhs, i);
+			const double* payoff = row(m_payoff, i);
+			double* current = row(m_values, i);
+			for (std::size_t k = 0; k < n; ++k)
+			{
+				double gaussSeidel = (rhs[k] - lower * previous[k] - upper * next[k]) * inverseDiagonal;
+				double updated = std::max(payoff[k], current[k] + omega * (gaussSeidel - current[k]));
+				maxChange = std::max(maxChange, std::abs(updated - current[k]));
+				current[k] = updated;
+			}
+		}
+		if (maxChange < m_settings.psorTolerance) break;
+	}
 }
 
-CorrelationCalculator& CorrelationCalculator::operator=(const
-	CorrelationCalculator& c)
+void FiniteDifferencePricer::solve(std::span<const double> strikes, PayoffType payoff, ExerciseStyle exercise)
 {
-	if (this != &c)
+	const std::size_t numNodes = m_settings.numSpots + 1;
+	const std::size_t last = m_settings.numSpots - 1;
+	const std::size_t n = strikes.size();
+	const double sign = payoff == PayoffType::Call ? 1.0 : -1.0;
+	const bool american = exercise == ExerciseStyle::American;
+	m_numStrikes = n;
+	m_values.resize(numNodes * n);
+	m_rhs.resize(numNodes * n);
+	m_payoff.resize(numNodes * n);
+	m_psorIterations = 0;
+
+	for (std::size_t i = 0; i < numNodes; ++i)
 	{
-		m_tsA = c.m_tsA;
-		m_tsB = c.m_tsB;
+		double* current = row(m_payoff, i);
+		for (std::size_t k = 0; k < n; ++k)
+		{
+			current[k] = std::max(sign * (double(i) * m_dS - strikes[k]), 0.0);
+		}
+	}
+	m_values = m_payoff;
+
+	const double dt = m_maturity / m_settings.numSteps;
+	const double schemeTheta = m_settings.scheme == FDScheme::Explicit ? 0.0 : m_settings.scheme == FDScheme::Implicit ? 1.0 : 0.5;
+	for (std::size_t step = 1; step <= m_settings.numSteps; ++step)
+	{
+		const double tau = double(step) * dt;  // time left to expiry after this step
+		const double theta = m_settings.scheme == FDScheme::CrankNicolson && step <= m_settings.smoothingSteps ? 1.0 : schemeTheta;
+
+		// explicit half of the step, from the values one step nearer expiry
+		for (std::size_t i = 1; i <= last; ++i)
+		{
+			const double a = (1.0 - theta) * m_a[i], b = (1.0 - theta) * m_b[i], c = (1.0 - theta) * m_c[i];
+			const double* previous = row(m_values, i - 1);
+			const double* current = row(m_values, i);
+			const double* next = row(m_values, i + 1);
+			double* rhs = row(m_rhs, i);
+			for (std::size_t k = 0; k < n; ++k)
+			{
+				rhs[k] = current[k] + a * previous[k] + b * current[k] + c * next[k];
+			}
+		}
+
+		// deep out of the money the option is worthless, deep in the money it is worth the discounted intrinsic value
+		// (or the plain intrinsic value for an American put, which would be exercised)
+		const double discount = std::exp(-m_rate * tau);
+		double* bottom = row(m_values, 0);
+		double* top = row(m_values, m_settings.numSpots);
+		for (std::size_t k = 0; k < n; ++k)
+		{
+			bottom[k] = payoff == PayoffType::Put ? (american ? strikes[k] : strikes[k] * discount) : 0.0;
+			top[k] = payoff == PayoffType::Call ? m_settings.spotMax - strikes[k] * discount : 0.0;
+		}
+
+		if (theta == 0.0)
+		{
+			for (std::size_t i = 1; i <= last; ++i)
+			{
+				double* current = row(m_values, i);
+				const double* rhs = row(m_rhs, i);
+				const double* intrinsic = row(m_payoff, i);
+				for (std::size_t k = 0; k < n; ++k)
+				{
+					current[k] = american ? std::max(rhs[k], intrinsic[k]) : rhs[k];
+				}
+			}
+			continue;
+		}
+
+		factorise(theta);
+		thomasSolve();
+		if (american) psorSolve(theta);
 	}
-	return *this;
 }
 
-double CorrelationCalculator::correlation()
+double FiniteDifferencePricer::value(double spot, std::size_t strikeIndex) const
 {
-	double sum = 0;
-	double meanA = m_tsA.mean();
-	double meanB = m_tsB.mean();
+	double position = std::clamp(spot / m_dS, 0.0, double(m_settings.numSpots));
+	std::size_t i = std::min(static_cast<std::size_t>(position), m_settings.numSpots - 1);
+	double weight = position - double(i);
+	return (1.0 - weight) * m_values[i * m_numStrikes + strikeIndex] + weight * m_values[(i + 1) * m_numStrikes + strikeIndex];
+}
 
-	if (m_tsA.size() != m_tsB.size())
+double blackScholesPrice(double spot, double strike, double rate, double vol, double maturity, PayoffType payoff)
+{
+	auto normCdf = [](double x) { return 0.5 * std::erfc(-x / std::sqrt(2.0)); };
+	double d1 = (std::log(spot / strike) + (rate + 0.5 * vol * vol) * maturity) / (vol * std::sqrt(maturity));
+	double d2 = d1 - vol * std::sqrt(maturity);
+	double discountedStrike = strike * std::exp(-rate * maturity);
+	if (payoff == PayoffType::Call) return spot * normCdf(d1) - discountedStrike * normCdf(d2);
+	return discountedStrike * normCdf(-d2) - spot * normCdf(-d1);
+}
+
+// Cox Ross Rubinstein tree, the backward phase runs in a single vector that shrinks by one node per step
+double binomialTreePrice(double spot, double strike, double rate, double vol, double maturity, std::size_t steps, PayoffType payoff, ExerciseStyle exercise)
+{
+	const double dt = maturity / steps;
+	const double up = std::exp(vol * std::sqrt(dt));
+	const double upSquared = up * up;
+	const double discount = std::exp(-rate * dt);
+	const double probabilityUp = (std::exp(rate * dt) - 1.0 / up) / (up - 1.0 / up);
+	const double sign = payoff == PayoffType::Call ? 1.0 : -1.0;
+
+	std::vector<double> values(steps + 1);
+	double price = spot * std::pow(up, -double(steps));
+	for (std::size_t j = 0; j <= steps; ++j)
 	{
-		// there are a different number of observations so fail
-		return -1;
+		values[j] = std::max(sign * (price - strike), 0.0);
+		price *= upSquared;
+	}
+	for (std::size_t n = steps; n-- > 0;)
+	{
+		price = spot * std::pow(up, -double(n));
+		for (std::size_t j = 0; j <= n; ++j)
+		{
+			double continuation = discount * (probabilityUp * values[j + 1] + (1.0 - probabilityUp) * values[j]);
+			values[j] = exercise == ExerciseStyle::American ? std::max(continuation, sign * (price - strike)) : continuation;
+			price *= upSquared;
+		}
 	}
+	return values[0];
+}
 
-	for (int i = 0; i < m_tsA.size(); ++i)
+// accuracy against time for each scheme and the binomial tree, on a European put (exact answer from Black Scholes)
+// and an American put (reference from a 20000 step tree), then many strikes priced on one shared grid
+void benchmarkFiniteDifference()
+{
+	const double spot = 100, strike = 100, rate = 0.05, vol = 0.2, maturity = 1.0, spotMax = 400;
+	const double strikes[] = { strike };
+	auto seconds = [](auto start) { return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); };
+
+	for (ExerciseStyle exercise : { ExerciseStyle::European, ExerciseStyle::American })
 	{
-		auto val = (m_tsA.elem(i) - meanA) * (m_tsB.elem(i) - meanB);
-		sum += val;
+		bool american = exercise == ExerciseStyle::American;
+		double reference = american
+			? 0.5 * (binomialTreePrice(spot, strike, rate, vol, maturity, 20000, PayoffType::Put, exercise)
+				+ binomialTreePrice(spot, strike, rate, vol, maturity, 20001, PayoffType::Put, exercise))  // averaging damps the odd/even wobble
+			: blackScholesPrice(spot, strike, rate, vol, maturity, PayoffType::Put);
+		std::cout << (american ? "American" : "European") << " put, reference " << reference << std::endl;
+
+		for (FDScheme scheme : { FDScheme::Explicit, FDScheme::Implicit, FDScheme::CrankNicolson })
+		{
+			const char* name = scheme == FDScheme::Explicit ? "explicit" : scheme == FDScheme::Implicit ? "implicit" : "crank nicolson";
+			for (std::size_t numSpots : { 100, 200, 400, 800 })
+			{
+				FDSettings settings;
+				settings.spotMax = spotMax;
+				settings.numSpots = numSpots;
+				settings.numSteps = scheme == FDScheme::Explicit ? stableExplicitSteps(rate, vol, maturity, numSpots) : numSpots;
+				settings.scheme = scheme;
+				auto start = std::chrono::steady_clock::now();
+				FiniteDifferencePricer pricer(rate, vol, maturity, settings);
+				pricer.solve(strikes, PayoffType::Put, exercise);
+				double price = pricer.value(spot);
+				double elapsed = seconds(start);
+				std::cout << "  " << name << " " << numSpots << " x " << settings.numSteps << ": error " << price - reference << " in " << elapsed * 1e3 << "ms";
+				if (american) std::cout << ", " << pricer.psorIterations() << " PSOR sweeps";
+				std::cout << std::endl;
+			}
+		}
+		for (std::size_t steps : { 100, 400, 1600, 6400 })
+		{
+			auto start = std::chrono::steady_clock::now();
+			double price = binomialTreePrice(spot, strike, rate, vol, maturity, steps, PayoffType::Put, exercise);
+			double elapsed = seconds(start);
+			std::cout << "  binomial " << steps << " steps: error " << price - reference << " in " << elapsed * 1e3 << "ms" << std::endl;
+		}
 	}
 
-	double stDevA = m_tsA.stdDev();
-	double stDevB = m_tsB.stdDev();
-	sum /= (stDevA * stDevB);
-	return sum / (m_tsB.size() - 1);
+	// a strip of American puts: one batched solve against a solve per strike and a tree per strike
+	std::vector<double> strip;
+	for (double k = 50; k <= 150; k += 1)
+	{
+		strip.push_back(k);
+	}
+	FDSettings settings;
+	settings.spotMax = spotMax;
+	settings.numSpots = 400;
+	settings.numSteps = 400;
+	FiniteDifferencePricer pricer(rate, vol, maturity, settings);
+
+	auto start = std::chrono::steady_clock::now();
+	pricer.solve(strip, PayoffType::Put, ExerciseStyle::American);
+	double batchSeconds = seconds(start);
+	std::vector<double> batched(strip.size());
+	for (std::size_t k = 0; k < strip.size(); ++k)
+	{
+		batched[k] = pricer.value(spot, k);
+	}
+
+	start = std::chrono::steady_clock::now();
+	double maxBatchDifference = 0;
+	for (std::size_t k = 0; k < strip.size(); ++k)
+	{
+		pricer.solve(std::span<const double>(&strip[k], 1), PayoffType::Put, ExerciseStyle::American);
+		maxBatchDifference = std::max(maxBatchDifference, std::abs(pricer.value(spot) - batched[k]));
+	}
+	double singleSeconds = seconds(start);
+
+	start = std::chrono::steady_clock::now();
+	double maxTreeDifference = 0;
+	for (std::size_t k = 0; k < strip.size(); ++k)
+	{
+		double tree = binomialTreePrice(spot, strip[k], rate, vol, maturity, 2000, PayoffType::Put, ExerciseStyle::American);
+		maxTreeDifference = std::max(maxTreeDifference, std::abs(tree - batched[k]));
+	}
+	double treeSeconds = seconds(start);
+
+	std::cout << strip.size() << " American puts on a 400 x 400 grid: batched " << batchSeconds * 1e3 << "ms, one at a time " << singleSeconds * 1e3
+		<< "ms (max difference " << maxBatchDifference << "), 2000 step trees " << treeSeconds * 1e3 << "ms (max difference " << maxTreeDifference << ")" << std::endl;
 }
 
 
@@ -520,6 +2654,25 @@ int main() {
 			std::cout << ", " << i << ", " << walk[i] << std::endl;
 		}
 	std::cout << std::endl;
+
+	// one independent stream per thread, the same seed always gives the same walks
+	Xoshiro256PlusPlus master(2024);
+	std::vector<double> buffer(100);
+	for (unsigned thread = 0; thread < 4; ++thread)
+	{
+		Xoshiro256PlusPlus rng = master.stream(thread);
+		rw.generateWalk(buffer, rng);
+		std::cout << "stream " << thread << " final price " << buffer.back() << std::endl;
+	}
+
+	benchmarkQuasiRandomConvergence();
+
+	checkMACalculator();
+
+	demoTickReplay("ticks_demo.bin");
+	benchmarkTickReplay("ticks_benchmark.bin", 4'000'000);
+
+	benchmarkFiniteDifference();
 	return 0;
 }
 
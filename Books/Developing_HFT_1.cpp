@@ -1,4 +1,26 @@
 # include <iostream>
+# include <cstdint>
+# include <vector>
+# include <limits>
+# include <algorithm>
+# include <bit>
+# include <chrono>
+# include <random>
+# include <new>
+# include <type_traits>
+# include <cstdlib>
+# include <memory_resource>
+# include <atomic>
+# include <array>
+# include <mutex>
+# include <thread>
+# include <string>
+# include <sstream>
+#if defined(_MSC_VER)
+# include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+# include <x86intrin.h>
+#endif
 
 // latency is the time between a task starting to when the task is finished
 // hft firms have applications and processes that are latency critical and fail completely if performance latency is higher than a specific threshold
@@ -182,6 +204,1115 @@ Therefore the base class can access the derived class by static_casting itself i
 // improve prediction by avoiding branches, unrolling loops and inlining
 enum class Side : int16_t {BUY = 1, SELL = -1};
 
+// Object pools
+// new and delete go through the general purpose heap: a search for a free block, locking, and over time a fragmented heap
+// a pool allocates one slab of slots for a single type up front, and hands slots out and takes them back in O(1)
+// free slots are chained together through their own storage (an intrusive free list), so the pool needs no extra memory,
+// and the most recently freed slot is reused first, while it is still in cache
+// objects are built in their slot with placement new, and are referred to by a 32 bit slot index (a handle),
+// which is half the size of a pointer and stays valid however the slab is laid out
+// in debug builds every slot also carries a live flag so that freeing a slot twice is caught straight away
+
+template <typename T>
+class MemPool
+{
+public:
+	using Handle = uint32_t;
+	static constexpr Handle kInvalidHandle = std::numeric_limits<Handle>::max();
+
+	explicit MemPool(uint32_t capacity);
+	~MemPool();
+	MemPool(const MemPool&) = delete;
+	MemPool& operator= (const MemPool&) = delete;
+
+	template <typename... Args>
+	Handle allocate(Args&&... args);  // kInvalidHandle if the pool is exhausted
+	void deallocate(Handle handle);
+
+	T& operator[] (Handle handle) { return *std::launder(reinterpret_cast<T*>(m_slots[handle].storage)); }
+	const T& operator[] (Handle handle) const { return *std::launder(reinterpret_cast<const T*>(m_slots[handle].storage)); }
+	uint32_t size() const { return m_size; }
+	uint32_t capacity() const { return uint32_t(m_slots.size()); }
+
+private:
+	struct Slot
+	{
+		union
+		{
+			alignas(T) unsigned char storage[sizeof(T)];
+			Handle nextFree;
+		};
+	};
+
+	std::vector<Slot> m_slots;
+	Handle m_freeHead;
+	uint32_t m_size;
+#ifndef NDEBUG
+	std::vector<bool> m_live;
+#endif
+};
+
+template <typename T>
+MemPool<T>::MemPool(uint32_t capacity) : m_slots(capacity), m_freeHead(capacity > 0 ? 0 : kInvalidHandle), m_size(0)
+{
+	for (uint32_t i = 0; i < capacity; ++i)
+	{
+		m_slots[i].nextFree = i + 1 < capacity ? i + 1 : kInvalidHandle;
+	}
+#ifndef NDEBUG
+	m_live.assign(capacity, false);
+#endif
+}
+
+template <typename T>
+MemPool<T>::~MemPool()
+{
+	if constexpr (!std::is_trivially_destructible_v<T>)
+	{
+		// the free list tells us which slots are empty, everything else still holds an object
+		std::vector<bool> isFree(m_slots.size());
+		for (Handle h = m_freeHead; h != kInvalidHandle; h = m_slots[h].nextFree)
+		{
+			isFree[h] = true;
+		}
+		for (Handle h = 0; h < m_slots.size(); ++h)
+		{
+			if (!isFree[h]) (*this)[h].~T();
+		}
+	}
+}
+
+template <typename T>
+template <typename... Args>
+typename MemPool<T>::Handle MemPool<T>::allocate(Args&&... args)
+{
+	Handle handle = m_freeHead;
+	if (handle == kInvalidHandle) return kInvalidHandle;
+	m_freeHead = m_slots[handle].nextFree;
+	new (m_slots[handle].storage) T(std::forward<Args>(args)...);
+	m_size++;
+#ifndef NDEBUG
+	m_live[handle] = true;
+#endif
+	return handle;
+}
+
+template <typename T>
+void MemPool<T>::deallocate(Handle handle)
+{
+#ifndef NDEBUG
+	if (handle >= m_slots.size() || !m_live[handle])
+	{
+		std::cerr << "MemPool: invalid or double free of handle " << handle << std::endl;
+		std::abort();
+	}
+	m_live[handle] = false;
+#endif
+	(*this)[handle].~T();
+	m_slots[handle].nextFree = m_freeHead;
+	m_freeHead = handle;
+	m_size--;
+}
+
+// Limit order book
+// an exchange feed is a stream of add, cancel and execute messages for individual orders, and the book is rebuilt from them
+// everything is sized up front so the hot path never allocates:
+// - price levels are a flat array indexed by (price - minimum price) in ticks, so finding a level is one subtraction
+// - orders live in a MemPool, and an array indexed by order id holds each live order's handle, so a cancel or execute finds
+//   its order with no hashing, and the pool keeps the live orders packed into as few cache lines as possible
+// - each level keeps its orders in time priority as a doubly linked list threaded through the pooled orders themselves
+//   (intrusive links), so adding to the back or unlinking from the middle touches at most three orders
+// - a bitmap marks which levels are non-empty, when the best level empties the next one is found 64 levels at a time
+
+using OrderId = uint32_t;
+using Price = int32_t;     // in ticks
+using Quantity = uint32_t;
+constexpr uint32_t kNoOrder = std::numeric_limits<uint32_t>::max();
+constexpr Price kNoPrice = std::numeric_limits<Price>::min();
+
+using OrderHandle = uint32_t;  // a MemPool<BookOrder>::Handle
+
+struct BookOrder
+{
+	OrderId id = kNoOrder;
+	Quantity quantity = 0;
+	Price price = 0;
+	OrderHandle prev = kNoOrder;
+	OrderHandle next = kNoOrder;
+	Side side = Side::BUY;
+};
+
+struct PriceLevel
+{
+	uint64_t quantity = 0;
+	uint32_t count = 0;
+	OrderHandle head = kNoOrder;  // oldest order, first to trade
+	OrderHandle tail = kNoOrder;
+};
+
+class OrderBook
+{
+public:
+	OrderBook(Price minPrice, Price maxPrice, uint32_t maxOrders, uint32_t maxLiveOrders = 0);  // ids run from 0 to maxOrders - 1
+
+	bool addOrder(OrderId id, Side side, Price price, Quantity quantity);
+	bool cancelOrder(OrderId id);
+	Quantity executeOrder(OrderId id, Quantity quantity);  // returns how much was executed, the order is removed once filled
+
+	Price bestBid() const { return levelPrice(m_bids.best); }
+	Price bestAsk() const { return levelPrice(m_asks.best); }
+	uint64_t levelQuantity(Side side, Price price) const;
+	uint32_t levelCount(Side side, Price price) const;  // number of resting orders at the level
+	OrderId frontOrder(Side side, Price price) const;  // oldest order at the level, kNoOrder if empty
+	Price nextLevel(Side side, Price price) const;     // next non-empty price behind price, moving away from the touch
+	Quantity orderQuantity(OrderId id) const { return id < m_handles.size() && m_handles[id] != kNoOrder ? m_orders[m_handles[id]].quantity : 0; }
+	uint32_t capacity() const { return uint32_t(m_handles.size()); }
+	bool hasRoom() const { return m_orders.size() < m_orders.capacity(); }  // the pool can take another resting order
+	Price minPrice() const { return m_minPrice; }
+	Price maxPrice() const { return m_minPrice + Price(m_bids.levels.size()) - 1; }
+
+private:
+	struct BookSide
+	{
+		std::vector<PriceLevel> levels;
+		std::vector<uint64_t> occupied;  // one bit per level
+		int best = -1;                   // level index of the best price, -1 if the side is empty
+	};
+
+	Price m_minPrice;
+	BookSide m_bids;
+	BookSide m_asks;
+	MemPool<BookOrder> m_orders;
+	std::vector<OrderHandle> m_handles;  // order id -> pool handle, kNoOrder if the order isn't in the book
+
+	BookSide& bookSide(Side side) { return side == Side::BUY ? m_bids : m_asks; }
+	const BookSide& bookSide(Side side) const { return side == Side::BUY ? m_bids : m_asks; }
+	Price levelPrice(int level) const { return level < 0 ? kNoPrice : m_minPrice + level; }
+	int levelIndex(Price price) const { return price - m_minPrice; }
+	static int highestOccupied(const BookSide& side, int from);  // highest non-empty level <= from
+	static int lowestOccupied(const BookSide& side, int from);   // lowest non-empty level >= from
+	void removeOrder(OrderHandle handle);
+};
+
+OrderBook::OrderBook(Price minPrice, Price maxPrice, uint32_t maxOrders, uint32_t maxLiveOrders)
+	: m_minPrice(minPrice), m_orders(maxLiveOrders > 0 ? maxLiveOrders : maxOrders), m_handles(maxOrders, kNoOrder)
+{
+	std::size_t numLevels = std::size_t(maxPrice - minPrice) + 1;
+	for (BookSide* side : { &m_bids, &m_asks })
+	{
+		side->levels.resize(numLevels);
+		side->occupied.resize((numLevels + 63) / 64);
+	}
+}
+
+bool OrderBook::addOrder(OrderId id, Side side, Price price, Quantity quantity)
+{
+	int level = levelIndex(price);
+	if (id >= m_handles.size() || m_handles[id] != kNoOrder || quantity == 0 || level < 0 || level >= int(m_bids.levels.size()))
+	{
+		return false;
+	}
+	BookSide& book = bookSide(side);
+	PriceLevel& priceLevel = book.levels[level];
+	OrderHandle handle = m_orders.allocate(BookOrder{ id, quantity, price, priceLevel.tail, kNoOrder, side });
+	if (handle == kNoOrder) return false;  // more live orders than the pool was sized for
+	m_handles[id] = handle;
+	if (priceLevel.tail != kNoOrder) m_orders[priceLevel.tail].next = handle;
+	else priceLevel.head = handle;
+	priceLevel.tail = handle;
+	priceLevel.quantity += quantity;
+	priceLevel.count++;
+
+	book.occupied[level >> 6] |= uint64_t(1) << (level & 63);
+	if (book.best < 0 || (side == Side::BUY ? level > book.best : level < book.best))
+	{
+		book.best = level;
+	}
+	return true;
+}
+
+void OrderBook::removeOrder(OrderHandle handle)
+{
+	BookOrder& order = m_orders[handle];
+	BookSide& book = bookSide(order.side);
+	int level = levelIndex(order.price);
+	PriceLevel& priceLevel = book.levels[level];
+
+	if (order.prev != kNoOrder) m_orders[order.prev].next = order.next;
+	else priceLevel.head = order.next;
+	if (order.next != kNoOrder) m_orders[order.next].prev = order.prev;
+	else priceLevel.tail = order.prev;
+	priceLevel.quantity -= order.quantity;
+
+	if (--priceLevel.count == 0)
+	{
+		book.occupied[level >> 6] &= ~(uint64_t(1) << (level & 63));
+		if (level == book.best)
+		{
+			book.best = order.side == Side::BUY ? highestOccupied(book, level) : lowestOccupied(book, level);
+		}
+	}
+	m_handles[order.id] = kNoOrder;
+	m_orders.deallocate(handle);
+}
+
+bool OrderBook::cancelOrder(OrderId id)
+{
+	if (id >= m_handles.size() || m_handles[id] == kNoOrder) return false;
+	removeOrder(m_handles[id]);
+	return true;
+}
+
+Quantity OrderBook::executeOrder(OrderId id, Quantity quantity)
+{
+	if (id >= m_handles.size() || m_handles[id] == kNoOrder) return 0;
+	BookOrder& order = m_orders[m_handles[id]];
+	Quantity executed = std::min(quantity, order.quantity);
+	if (executed == order.quantity)
+	{
+		removeOrder(m_handles[id]);
+		return executed;
+	}
+	order.quantity -= executed;
+	bookSide(order.side).levels[levelIndex(order.price)].quantity -= executed;
+	return executed;
+}
+
+int OrderBook::highestOccupied(const BookSide& side, int from)
+{
+	if (from < 0) return -1;
+	int word = from >> 6;
+	uint64_t bits = side.occupied[word] & (~uint64_t(0) >> (63 - (from & 63)));
+	while (bits == 0)
+	{
+		if (--word < 0) return -1;
+		bits = side.occupied[word];
+	}
+	return word * 64 + 63 - std::countl_zero(bits);
+}
+
+int OrderBook::lowestOccupied(const BookSide& side, int from)
+{
+	int words = int(side.occupied.size());
+	int word = from >> 6;
+	if (word >= words) return -1;
+	uint64_t bits = side.occupied[word] & (~uint64_t(0) << (from & 63));
+	while (bits == 0)
+	{
+		if (++word >= words) return -1;
+		bits = side.occupied[word];
+	}
+	int level = word * 64 + std::countr_zero(bits);
+	return level < int(side.levels.size()) ? level : -1;
+}
+
+uint64_t OrderBook::levelQuantity(Side side, Price price) const
+{
+	int level = levelIndex(price);
+	if (level < 0 || level >= int(m_bids.levels.size())) return 0;
+	return bookSide(side).levels[level].quantity;
+}
+
+uint32_t OrderBook::levelCount(Side side, Price price) const
+{
+	int level = levelIndex(price);
+	if (level < 0 || level >= int(m_bids.levels.size())) return 0;
+	return bookSide(side).levels[level].count;
+}
+
+OrderId OrderBook::frontOrder(Side side, Price price) const
+{
+	int level = levelIndex(price);
+	if (level < 0 || level >= int(m_bids.levels.size())) return kNoOrder;
+	OrderHandle head = bookSide(side).levels[level].head;
+	return head == kNoOrder ? kNoOrder : m_orders[head].id;
+}
+
+Price OrderBook::nextLevel(Side side, Price price) const
+{
+	const BookSide& book = bookSide(side);
+	int level = levelIndex(price);
+	return levelPrice(side == Side::BUY ? highestOccupied(book, level - 1) : lowestOccupied(book, level + 1));
+}
+
+// a synthetic feed: orders arrive a few ticks either side of a drifting mid price, and live orders are cancelled or executed at random
+// the generator keeps its own book so that, like a real exchange feed, an order priced through the far touch shows up
+// as an execution of the resting order it would trade with rather than an add that crosses the book
+enum class MessageType : uint8_t { Add, Cancel, Execute };
+
+struct BookMessage
+{
+	MessageType type;
+	Side side;
+	OrderId id;
+	Price price;
+	Quantity quantity;
+};
+
+void applyMessage(OrderBook& book, const BookMessage& message)
+{
+	switch (message.type)
+	{
+	case MessageType::Add: book.addOrder(message.id, message.side, message.price, message.quantity); break;
+	case MessageType::Cancel: book.cancelOrder(message.id); break;
+	case MessageType::Execute: book.executeOrder(message.id, message.quantity); break;
+	}
+}
+
+std::vector<BookMessage> generateBookMessages(std::size_t numMessages, Price mid, uint64_t seed)
+{
+	std::mt19937_64 gen(seed);
+	std::uniform_int_distribution<int> action(0, 99), offset(0, 20), size(1, 500), step(-1, 1);
+	std::vector<BookMessage> messages;
+	messages.reserve(numMessages);
+	std::vector<OrderId> live;
+	const Price kMaxDrift = 10'000;  // the mid is kept within this many ticks of where it started
+	const Price start = mid;
+	OrderBook book(start - kMaxDrift - 100, start + kMaxDrift + 100, uint32_t(numMessages));
+	OrderId nextId = 0;
+	while (messages.size() < numMessages)
+	{
+		int roll = action(gen);
+		if (live.empty() || roll < 55)
+		{
+			mid = std::clamp(mid + step(gen), start - kMaxDrift, start + kMaxDrift);
+			Side side = (gen() & 1) ? Side::BUY : Side::SELL;
+			Price price = side == Side::BUY ? mid - 1 - offset(gen) : mid + 1 + offset(gen);
+			Quantity quantity = Quantity(size(gen));
+			Price touch = side == Side::BUY ? book.bestAsk() : book.bestBid();
+			if (touch != kNoPrice && (side == Side::BUY ? price >= touch : price <= touch))
+			{
+				OrderId resting = book.frontOrder(side == Side::BUY ? Side::SELL : Side::BUY, touch);
+				messages.push_back({ MessageType::Execute, Side::BUY, resting, 0, quantity });
+				book.executeOrder(resting, quantity);
+				continue;
+			}
+			messages.push_back({ MessageType::Add, side, nextId, price, quantity });
+			book.addOrder(nextId, side, price, quantity);
+			live.push_back(nextId++);
+			continue;
+		}
+		std::size_t pick = gen() % live.size();
+		OrderId id = live[pick];
+		if (book.orderQuantity(id) != 0)
+		{
+			if (roll < 90) messages.push_back({ MessageType::Cancel, Side::BUY, id, 0, 0 });
+			else messages.push_back({ MessageType::Execute, Side::BUY, id, 0, Quantity(size(gen)) });  // may or may not fill the order
+			applyMessage(book, messages.back());
+		}
+		if (book.orderQuantity(id) == 0)
+		{
+			live[pick] = live.back();
+			live.pop_back();
+		}
+	}
+	return messages;
+}
+
+void printLatencyPercentiles(const char* label, std::vector<uint32_t>& nanos)
+{
+	std::sort(nanos.begin(), nanos.end());
+	auto percentile = [&](double p) { return nanos[std::min(nanos.size() - 1, std::size_t(p * nanos.size()))]; };
+	std::cout << label << " p50 " << percentile(0.5) << " ns, p99 " << percentile(0.99) << " ns, p99.9 " << percentile(0.999)
+		<< " ns, max " << nanos.back() << " ns" << std::endl;
+}
+
+void benchmarkOrderBook(std::size_t numMessages)
+{
+	// the whole stream is generated before timing, so replay only touches the book and the clock
+	std::vector<BookMessage> messages = generateBookMessages(numMessages, 50'000, 7);
+	OrderBook book(0, 100'000, uint32_t(numMessages), 1 << 20);  // ids are never reused, but far fewer orders are live at once
+	std::vector<uint32_t> nanos(messages.size());
+
+	auto begin = std::chrono::steady_clock::now();
+	for (std::size_t i = 0; i < messages.size(); ++i)
+	{
+		auto start = std::chrono::steady_clock::now();
+		applyMessage(book, messages[i]);
+		nanos[i] = uint32_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	std::cout << messages.size() << " book messages in " << seconds * 1e3 << " ms, best bid " << book.bestBid() << " best ask " << book.bestAsk() << std::endl;
+	printLatencyPercentiles("order book latency (including clock reads)", nanos);
+}
+
+
+// Matching engine
+// an incoming order trades against the opposite side of the book in price-time priority: best price first,
+// and at the same price the oldest order first, which is exactly the head of the level's FIFO
+// - a limit order trades while the book crosses its price, then the remainder rests in the book
+// - a market order trades at any price, and whatever can't be filled is cancelled
+// - an immediate-or-cancel (IOC) order is a limit order whose remainder is cancelled instead of resting
+// - a fill-or-kill (FOK) order trades in full or not at all, so the quantity available up to its limit is checked first
+// fills are written into a buffer the caller allocated up front, and the book is preallocated, so after warm-up
+// submitting an order never touches the heap
+
+enum class OrderType : uint8_t { Limit, Market, ImmediateOrCancel, FillOrKill };
+
+enum class MatchStatus : uint8_t
+{
+	Rested,     // a limit order with quantity left in the book
+	Filled,
+	Cancelled,  // market or IOC remainder, a FOK that couldn't be filled in full or whose fills wouldn't fit in the fill buffer,
+	            // or a limit remainder the book had no room to rest
+	Truncated,  // the fill buffer ran out of room, the unmatched remainder was cancelled
+	Rejected    // bad id, price or quantity, or no room in the book, always before anything traded
+};
+
+struct NewOrder
+{
+	OrderId id;
+	Side side;
+	OrderType type;
+	Price price;  // ignored for market orders
+	Quantity quantity;
+};
+
+struct Fill
+{
+	OrderId taker;
+	OrderId maker;
+	Price price;
+	Quantity quantity;
+};
+
+class FillBuffer
+{
+public:
+	FillBuffer(std::size_t capacity) : m_fills(capacity), m_size(0) {}
+	void clear() { m_size = 0; }
+	bool full() const { return m_size == m_fills.size(); }
+	std::size_t room() const { return m_fills.size() - m_size; }
+	void push(const Fill& fill) { m_fills[m_size++] = fill; }
+	std::size_t size() const { return m_size; }
+	const Fill& operator[] (std::size_t i) const { return m_fills[i]; }
+
+private:
+	std::vector<Fill> m_fills;
+	std::size_t m_size;
+};
+
+class MatchingEngine
+{
+public:
+	MatchingEngine(Price minPrice, Price maxPrice, uint32_t maxOrders, uint32_t maxLiveOrders = 0) : m_book(minPrice, maxPrice, maxOrders, maxLiveOrders) {}
+
+	MatchStatus submit(const NewOrder& order, FillBuffer& fills);  // appends this order's fills to fills
+	bool cancel(OrderId id) { return m_book.cancelOrder(id); }
+	const OrderBook& book() const { return m_book; }
+
+private:
+	OrderBook m_book;
+
+	bool crosses(const NewOrder& order, Price touch) const;
+	bool canFill(const NewOrder& order, std::size_t& makers) const;  // makers is an upper bound on the fills it would take
+};
+
+bool MatchingEngine::crosses(const NewOrder& order, Price touch) const
+{
+	if (touch == kNoPrice) return false;
+	if (order.type == OrderType::Market) return true;
+	return order.side == Side::BUY ? touch <= order.price : touch >= order.price;
+}
+
+bool MatchingEngine::canFill(const NewOrder& order, std::size_t& makers) const
+{
+	// walk the opposite levels only as far as needed, usually one or two
+	Side opposite = order.side == Side::BUY ? Side::SELL : Side::BUY;
+	uint64_t available = 0;
+	makers = 0;
+	for (Price touch = opposite == Side::SELL ? m_book.bestAsk() : m_book.bestBid(); crosses(order, touch); touch = m_book.nextLevel(opposite, touch))
+	{
+		available += m_book.levelQuantity(opposite, touch);
+		makers += m_book.levelCount(opposite, touch);
+		if (available >= order.quantity) return true;
+	}
+	return false;
+}
+
+MatchStatus MatchingEngine::submit(const NewOrder& order, FillBuffer& fills)
+{
+	if (order.quantity == 0 || order.id >= m_book.capacity() || m_book.orderQuantity(order.id) != 0)
+	{
+		return MatchStatus::Rejected;
+	}
+	// a limit order that could never rest is refused before it trades, so a rejected order has never been filled
+	if (order.type == OrderType::Limit && (order.price < m_book.minPrice() || order.price > m_book.maxPrice()))
+	{
+		return MatchStatus::Rejected;
+	}
+	// likewise a limit order that won't trade and has no free slot in the book to rest in
+	Side opposite = order.side == Side::BUY ? Side::SELL : Side::BUY;
+	if (order.type == OrderType::Limit && !m_book.hasRoom() && !crosses(order, opposite == Side::SELL ? m_book.bestAsk() : m_book.bestBid()))
+	{
+		return MatchStatus::Rejected;
+	}
+	// fill or kill is all or nothing, so it must also be sure of room for every fill before it takes the first one
+	std::size_t makers = 0;
+	if (order.type == OrderType::FillOrKill && (!canFill(order, makers) || makers > fills.room()))
+	{
+		return MatchStatus::Cancelled;
+	}
+
+	Quantity remaining = order.quantity;
+	while (remaining > 0)
+	{
+		Price touch = opposite == Side::SELL ? m_book.bestAsk() : m_book.bestBid();
+		if (!crosses(order, touch)) break;
+		if (fills.full()) return MatchStatus::Truncated;
+		OrderId maker = m_book.frontOrder(opposite, touch);
+		Quantity traded = m_book.executeOrder(maker, remaining);
+		fills.push({ order.id, maker, touch, traded });
+		remaining -= traded;
+	}
+
+	if (remaining == 0) return MatchStatus::Filled;
+	if (order.type != OrderType::Limit) return MatchStatus::Cancelled;
+	if (m_book.addOrder(order.id, order.side, order.price, remaining)) return MatchStatus::Rested;
+	// reaching here the order has traded, every maker it used up freed a slot so the book should have had room,
+	// but its fills are already in the buffer, so the unrested remainder is reported as cancelled, never as rejected
+	return remaining < order.quantity ? MatchStatus::Cancelled : MatchStatus::Rejected;
+}
+
+// synthetic order flow: mostly passive limit orders around a drifting mid, with aggressive limits, market, IOC and FOK
+// orders and cancels of earlier orders mixed in (a cancel for an order that has already traded is simply refused)
+struct OrderRequest
+{
+	bool isCancel;
+	NewOrder order;
+};
+
+std::vector<OrderRequest> generateOrderFlow(std::size_t numRequests, Price mid, uint64_t seed)
+{
+	std::mt19937_64 gen(seed);
+	std::uniform_int_distribution<int> action(0, 99), offset(0, 10), size(1, 300), step(-1, 1);
+	const Price start = mid, kMaxDrift = 10'000;
+	std::vector<OrderRequest> requests;
+	requests.reserve(numRequests);
+	OrderId nextId = 0;
+	for (std::size_t i = 0; i < numRequests; ++i)
+	{
+		int roll = action(gen);
+		if (nextId > 0 && roll < 30)
+		{
+			OrderId id = OrderId(gen() % nextId);
+			requests.push_back({ true, { id, Side::BUY, OrderType::Limit, 0, 0 } });
+			continue;
+		}
+		mid = std::clamp(mid + step(gen), start - kMaxDrift, start + kMaxDrift);
+		Side side = (gen() & 1) ? Side::BUY : Side::SELL;
+		int direction = side == Side::BUY ? 1 : -1;
+		OrderType type = roll < 80 ? OrderType::Limit : roll < 87 ? OrderType::Market : roll < 95 ? OrderType::ImmediateOrCancel : OrderType::FillOrKill;
+		Price price = roll < 70 ? mid - direction * (1 + offset(gen)) : mid + direction * offset(gen);  // passive or marketable
+		requests.push_back({ false, { nextId++, side, type, price, Quantity(size(gen)) } });
+	}
+	return requests;
+}
+
+void benchmarkMatchingEngine(std::size_t numRequests)
+{
+	std::vector<OrderRequest> requests = generateOrderFlow(numRequests, 50'000, 11);
+	MatchingEngine engine(50'000 - 10'100, 50'000 + 10'100, uint32_t(numRequests));
+	FillBuffer fills(4'096);
+	std::vector<uint32_t> nanos(requests.size());
+	std::size_t totalFills = 0, statusCounts[5] = {};
+
+	auto begin = std::chrono::steady_clock::now();
+	for (std::size_t i = 0; i < requests.size(); ++i)
+	{
+		auto start = std::chrono::steady_clock::now();
+		fills.clear();
+		if (requests[i].isCancel) engine.cancel(requests[i].order.id);
+		else statusCounts[int(engine.submit(requests[i].order, fills))]++;
+		nanos[i] = uint32_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+		totalFills += fills.size();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	std::cout << requests.size() << " requests in " << seconds * 1e3 << " ms (" << requests.size() / seconds << " per second), " << totalFills
+		<< " fills, rested " << statusCounts[0] << " filled " << statusCounts[1] << " cancelled " << statusCounts[2] << std::endl;
+	printLatencyPercentiles("matching engine latency (including clock reads)", nanos);
+}
+
+// allocate/free churn: keep a working set of live market data events and repeatedly free a random one and allocate a
+// replacement, which is what a feed handler does all day. Each allocator runs the same precomputed sequence of slots
+struct MarketDataEvent
+{
+	uint64_t timestamp;
+	OrderId id;
+	Price price;
+	Quantity quantity;
+	Side side;
+	MessageType type;
+	char symbol[8];
+};
+
+void benchmarkAllocators(std::size_t liveEvents, std::size_t numOperations)
+{
+	std::mt19937_64 gen(5);
+	std::vector<uint32_t> victims(numOperations);
+	for (uint32_t& victim : victims)
+	{
+		victim = uint32_t(gen() % liveEvents);
+	}
+	MarketDataEvent event{ 0, 0, 10'000, 100, Side::BUY, MessageType::Add, "ABCD" };
+
+	auto churn = [&](const char* label, auto allocate, auto release) {
+		std::vector<decltype(allocate())> live(liveEvents);
+		for (auto& slot : live) slot = allocate();
+		std::vector<uint32_t> nanos(numOperations);
+		for (std::size_t i = 0; i < numOperations; ++i)
+		{
+			// the fences stop the compiler moving the inlined pool operations out from between the two clock reads
+			auto start = std::chrono::steady_clock::now();
+			std::atomic_signal_fence(std::memory_order_seq_cst);
+			release(live[victims[i]]);
+			live[victims[i]] = allocate();
+			std::atomic_signal_fence(std::memory_order_seq_cst);
+			nanos[i] = uint32_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+		}
+		printLatencyPercentiles(label, nanos);
+
+		// a clock read costs more than a pool operation, so also time the whole sequence again without them
+		auto start = std::chrono::steady_clock::now();
+		for (std::size_t i = 0; i < numOperations; ++i)
+		{
+			release(live[victims[i]]);
+			live[victims[i]] = allocate();
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "    mean " << seconds * 1e9 / numOperations << " ns per free + allocate without clock reads" << std::endl;
+		for (auto& slot : live) release(slot);
+	};
+
+	MemPool<MarketDataEvent> pool(static_cast<uint32_t>(liveEvents));
+	churn("MemPool free + allocate", [&]() { return pool.allocate(event); }, [&](MemPool<MarketDataEvent>::Handle h) { pool.deallocate(h); });
+
+	churn("new/delete free + allocate", [&]() { return new MarketDataEvent(event); }, [](MarketDataEvent* p) { delete p; });
+
+	std::pmr::unsynchronized_pool_resource resource;
+	std::pmr::polymorphic_allocator<MarketDataEvent> allocator(&resource);
+	churn("std::pmr pool free + allocate", [&]() {
+		MarketDataEvent* p = allocator.allocate(1);
+		new (p) MarketDataEvent(event);
+		return p;
+	}, [&](MarketDataEvent* p) { allocator.deallocate(p, 1); });
+}
+
+// Asynchronous logging
+// formatting numbers into text and writing to std::cout takes microseconds and can block on the terminal or disk,
+// so it has no place on the hot path. Instead the hot path only writes a format id, the raw argument bits and a timestamp
+// straight into the next slot of a ring buffer that belongs to the calling thread, then publishes the slot
+// a background thread drains every ring, does the formatting and writes the text out
+// each ring has exactly one writer and one reader (single producer single consumer), so it needs no locks, only an
+// acquire/release pair on the head and tail indices, and the two indices sit on separate cache lines so the threads don't fight over one
+// if a ring is full the record is dropped and counted, the caller never waits
+// every logger gets an id that is never reused, and each thread caches the ring it last used together with that id,
+// so the fast path is one compare. A cache miss (a thread's first call, or a thread switching between loggers) takes the
+// registration lock and looks the thread up in the logger's own table, so a thread never owns more than one ring per logger
+// and a new logger that happens to reuse a destroyed logger's address can never pick up one of its deleted rings
+
+enum class LogArgType : uint8_t { Signed, Unsigned, Double, String };
+
+// the hot path stamps records with the CPU's time stamp counter, a single instruction that costs a fraction of steady_clock::now()
+// the background thread converts counter ticks to steady_clock nanoseconds using the rate it measures between the two clocks
+// on other CPUs this falls back to steady_clock itself, and the measured rate comes out as 1
+inline uint64_t readCycleCounter()
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+inline uint64_t steadyNanos()
+{
+	return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+struct LogRecord
+{
+	static constexpr int kMaxArgs = 4;
+	uint64_t timestamp;  // readCycleCounter() when the call was made
+	uint16_t formatId;
+	uint8_t numArgs;
+	LogArgType types[kMaxArgs];
+	uint64_t args[kMaxArgs];
+};
+
+class LogRing
+{
+public:
+	static constexpr uint32_t kCapacity = 1 << 14;  // a power of two, so wrapping is a mask
+
+	static constexpr uint32_t kPrefetchAhead = 4;   // slots, so by the time the producer gets there the line is already in cache
+
+	// the producer fills the returned slot in place and then calls publish(), so no record is built on the stack and copied
+	// returns nullptr if the ring is full
+	LogRecord* claim()
+	{
+		uint64_t head = m_head.load(std::memory_order_relaxed);
+		if (head - m_cachedTail == kCapacity)
+		{
+			m_cachedTail = m_tail.load(std::memory_order_acquire);  // only re-read the consumer's index when the ring looks full
+			if (head - m_cachedTail == kCapacity) [[unlikely]] return nullptr;
+		}
+		// the consumer touched these slots last, so without this a write every few calls misses the cache, which showed up at p99
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+		_mm_prefetch(reinterpret_cast<const char*>(&m_records[(head + kPrefetchAhead) & (kCapacity - 1)]), _MM_HINT_T0);
+#endif
+		return &m_records[head & (kCapacity - 1)];
+	}
+
+	void publish()
+	{
+		m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	bool tryPop(LogRecord& record)
+	{
+		uint64_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail == m_head.load(std::memory_order_acquire)) return false;
+		record = m_records[tail & (kCapacity - 1)];
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool empty() const { return m_tail.load(std::memory_order_acquire) == m_head.load(std::memory_order_acquire); }
+
+	std::atomic<uint64_t> dropped{ 0 };  // only written by the producer
+
+private:
+	alignas(64) std::atomic<uint64_t> m_head{ 0 };  // written by the producer
+	uint64_t m_cachedTail = 0;                       // the producer's last view of m_tail
+	alignas(64) std::atomic<uint64_t> m_tail{ 0 };  // written by the consumer
+	alignas(64) LogRecord m_records[kCapacity];
+};
+
+class AsyncLogger
+{
+public:
+	static constexpr int kMaxThreads = 64;
+	static constexpr int kMaxFormats = 1024;
+	static constexpr uint16_t kInvalidFormat = 0xFFFF;  // returned by registerFormat once kMaxFormats are registered
+
+	AsyncLogger(std::ostream& out);
+	~AsyncLogger();
+	AsyncLogger(const AsyncLogger&) = delete;
+	AsyncLogger& operator= (const AsyncLogger&) = delete;
+
+	// formats use {} for each argument, e.g. "fill {} @ {}", and must outlive the logger (string literals are ideal)
+	uint16_t registerFormat(const char* format);
+
+	// const char* arguments are stored as pointers, so they must be string literals or otherwise outlive the logger
+	// calls with an unregistered format id, or from a thread beyond kMaxThreads, are dropped and counted like overflows
+	template <typename... Args>
+	void log(uint16_t formatId, Args... args);
+
+	uint64_t overflowCount() const;  // every call that was dropped rather than written
+	void waitUntilDrained() const;   // blocks until the background thread has taken every record pushed so far
+
+private:
+	std::ostream& m_out;
+	std::array<std::atomic<const char*>, kMaxFormats> m_formats{};
+	std::atomic<int> m_numFormats{ 0 };
+	std::array<std::atomic<LogRing*>, kMaxThreads> m_rings{};
+	std::array<uint64_t, kMaxThreads> m_ringOwners{};  // thread token of each ring's producer, guarded by m_registerMutex
+	std::atomic<int> m_numRings{ 0 };
+	std::atomic<uint64_t> m_rejected{ 0 };  // calls dropped before reaching a ring
+	std::mutex m_registerMutex;  // only taken when a thread's cached ring belongs to another logger
+	const uint64_t m_id;
+	const uint64_t m_startCycles;  // the two clocks read together when the logger starts, the origin for converting timestamps
+	const uint64_t m_startNanos;
+	std::atomic<bool> m_running{ true };
+	std::thread m_thread;
+
+	LogRing* localRing();
+	LogRing* registerThread();
+	void run();
+	void write(const LogRecord& record, std::string& buffer, double nanosPerCycle) const;
+
+	template <typename T>
+	static void storeArg(LogRecord& record, T value);
+};
+
+static std::atomic<uint64_t> s_nextLoggerToken{ 1 };  // logger ids and thread tokens, both unique for the life of the process
+
+AsyncLogger::AsyncLogger(std::ostream& out) : m_out(out), m_id(s_nextLoggerToken.fetch_add(1)), m_startCycles(readCycleCounter()),
+	m_startNanos(steadyNanos()), m_thread(&AsyncLogger::run, this)
+{
+}
+
+AsyncLogger::~AsyncLogger()
+{
+	m_running.store(false, std::memory_order_release);
+	m_thread.join();
+	for (int i = 0; i < m_numRings.load(); ++i)
+	{
+		delete m_rings[i].load();
+	}
+}
+
+uint16_t AsyncLogger::registerFormat(const char* format)
+{
+	std::lock_guard<std::mutex> lock(m_registerMutex);
+	int id = m_numFormats.load(std::memory_order_relaxed);
+	if (id == kMaxFormats) return kInvalidFormat;
+	m_formats[id].store(format, std::memory_order_relaxed);
+	m_numFormats.store(id + 1, std::memory_order_release);
+	return uint16_t(id);
+}
+
+struct LoggerThreadCache
+{
+	uint64_t token = s_nextLoggerToken.fetch_add(1);  // identifies this thread to every logger
+	uint64_t loggerId = 0;                            // logger the cached ring belongs to, 0 for none
+	LogRing* ring = nullptr;
+};
+static thread_local LoggerThreadCache s_loggerThreadCache;
+
+inline LogRing* AsyncLogger::localRing()
+{
+	LoggerThreadCache& cache = s_loggerThreadCache;
+	if (cache.loggerId == m_id) return cache.ring;
+	return registerThread();
+}
+
+LogRing* AsyncLogger::registerThread()
+{
+	LoggerThreadCache& cache = s_loggerThreadCache;
+	std::lock_guard<std::mutex> lock(m_registerMutex);
+	int numRings = m_numRings.load(std::memory_order_relaxed);
+	LogRing* ring = nullptr;
+	for (int i = 0; i < numRings && ring == nullptr; ++i)
+	{
+		if (m_ringOwners[i] == cache.token) ring = m_rings[i].load(std::memory_order_relaxed);  // logged here before, then switched away
+	}
+	if (ring == nullptr)
+	{
+		if (numRings == kMaxThreads) return nullptr;
+		ring = new LogRing();
+		m_ringOwners[numRings] = cache.token;
+		m_rings[numRings].store(ring, std::memory_order_relaxed);
+		m_numRings.store(numRings + 1, std::memory_order_release);
+	}
+	cache.loggerId = m_id;
+	cache.ring = ring;
+	return ring;
+}
+
+template <typename T>
+void AsyncLogger::storeArg(LogRecord& record, T value)
+{
+	uint8_t i = record.numArgs++;
+	if constexpr (std::is_same_v<T, const char*> || std::is_same_v<T, char*>)
+	{
+		record.types[i] = LogArgType::String;
+		record.args[i] = reinterpret_cast<uintptr_t>(value);
+	}
+	else if constexpr (std::is_floating_point_v<T>)
+	{
+		record.types[i] = LogArgType::Double;
+		record.args[i] = std::bit_cast<uint64_t>(double(value));
+	}
+	else if constexpr (std::is_signed_v<T>)
+	{
+		record.types[i] = LogArgType::Signed;
+		record.args[i] = uint64_t(int64_t(value));
+	}
+	else
+	{
+		record.types[i] = LogArgType::Unsigned;
+		record.args[i] = uint64_t(value);
+	}
+}
+
+template <typename... Args>
+void AsyncLogger::log(uint16_t formatId, Args... args)
+{
+	static_assert(sizeof...(Args) <= LogRecord::kMaxArgs, "too many log arguments");
+	LogRing* ring = localRing();
+	if (ring == nullptr || formatId >= m_numFormats.load(std::memory_order_acquire)) [[unlikely]]
+	{
+		m_rejected.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	LogRecord* record = ring->claim();
+	if (record == nullptr) [[unlikely]]
+	{
+		ring->dropped.store(ring->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		return;
+	}
+	record->timestamp = readCycleCounter();
+	record->formatId = formatId;
+	record->numArgs = 0;
+	(storeArg(*record, args), ...);
+	ring->publish();
+}
+
+uint64_t AsyncLogger::overflowCount() const
+{
+	uint64_t total = m_rejected.load(std::memory_order_relaxed);
+	for (int i = 0; i < m_numRings.load(std::memory_order_acquire); ++i)
+	{
+		total += m_rings[i].load(std::memory_order_relaxed)->dropped.load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+void AsyncLogger::waitUntilDrained() const
+{
+	for (int i = 0; i < m_numRings.load(std::memory_order_acquire); ++i)
+	{
+		while (!m_rings[i].load(std::memory_order_relaxed)->empty())
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+void AsyncLogger::write(const LogRecord& record, std::string& buffer, double nanosPerCycle) const
+{
+	buffer.clear();
+	buffer += std::to_string(m_startNanos + uint64_t(double(int64_t(record.timestamp - m_startCycles)) * nanosPerCycle));
+	buffer += ' ';
+	const char* format = m_formats[record.formatId].load(std::memory_order_relaxed);
+	int arg = 0;
+	for (const char* c = format; *c != '\0'; ++c)
+	{
+		if (c[0] == '{' && c[1] == '}' && arg < record.numArgs)
+		{
+			uint64_t bits = record.args[arg];
+			switch (record.types[arg++])
+			{
+			case LogArgType::Signed: buffer += std::to_string(int64_t(bits)); break;
+			case LogArgType::Unsigned: buffer += std::to_string(bits); break;
+			case LogArgType::Double: buffer += std::to_string(std::bit_cast<double>(bits)); break;
+			case LogArgType::String: buffer += reinterpret_cast<const char*>(uintptr_t(bits)); break;
+			}
+			++c;
+			continue;
+		}
+		buffer += *c;
+	}
+	buffer += '\n';
+	m_out << buffer;
+}
+
+void AsyncLogger::run()
+{
+	LogRecord record;
+	std::string buffer;
+	for (;;)
+	{
+		bool stopping = !m_running.load(std::memory_order_acquire);  // read before draining, so nothing pushed earlier is missed
+		bool wrote = false;
+		// the rate is measured over the whole life of the logger, so the error from reading the two clocks a few ns apart keeps shrinking
+		int64_t cycles = int64_t(readCycleCounter() - m_startCycles);
+		double nanosPerCycle = cycles > 0 ? double(steadyNanos() - m_startNanos) / double(cycles) : 1.0;
+		int numRings = m_numRings.load(std::memory_order_acquire);
+		for (int i = 0; i < numRings; ++i)
+		{
+			LogRing* ring = m_rings[i].load(std::memory_order_relaxed);
+			while (ring->tryPop(record))
+			{
+				write(record, buffer, nanosPerCycle);
+				wrote = true;
+			}
+		}
+		if (wrote) m_out.flush();
+		else if (stopping) return;
+		else std::this_thread::sleep_for(std::chrono::microseconds(100));
+	}
+}
+
+// the latency run logs in short bursts and lets the background thread drain between bursts (untimed), so every timed call
+// takes the normal path, and a burst is over before the background thread's 100us nap ends, so on a single core it doesn't
+// land in the middle of the timed calls. A clock read costs about as much as a log call, so the same percentiles are printed
+// for an empty timed region and subtracted, and the whole run is also timed with no clock reads per call.
+// the flood run then logs flat out without pauses, which is closer to real load: the background thread competes for the
+// core and the ring fills up, which a single background thread can't keep up with. It is timed per call too, and checks
+// that every call is either written or counted as dropped
+// the target is a p99 under 50 ns per call. It is NOT met yet: on the single core VM this was measured on, both runs give
+// a p99 of about 60-100 ns less the clock overhead (mean about 35 ns), and __rdtsc() alone costs about 25 ns there.
+// In the flood run the background thread shares the core and evicts the producer's cache lines. Checking the target needs a
+// multi-core host with the background thread pinned to its own core, and the flood run's p99 is the number to check
+void benchmarkAsyncLogger(std::size_t numCalls)
+{
+	std::ostringstream sink;  // formatted text goes to memory so the benchmark measures the logger, not the terminal
+	const std::size_t burst = 512;
+	std::vector<uint32_t> nanos(numCalls), clockNanos(numCalls);
+	double totalSeconds = 0;
+	uint64_t overflows;
+	{
+		AsyncLogger logger(sink);
+		uint16_t fillFormat = logger.registerFormat("fill order {} qty {} @ {} ({})");
+		logger.log(fillFormat, 0u, 0u, 0.0, "warm up");  // the first call from a thread registers its ring
+		for (std::size_t first = 0; first < numCalls; first += burst)
+		{
+			logger.waitUntilDrained();
+			std::size_t last = std::min(numCalls, first + burst);
+			for (std::size_t i = first; i < last; ++i)
+			{
+				auto start = std::chrono::steady_clock::now();
+				std::atomic_signal_fence(std::memory_order_seq_cst);
+				logger.log(fillFormat, uint32_t(i), int(i % 500), 100.25 + i % 7, "maker");
+				std::atomic_signal_fence(std::memory_order_seq_cst);
+				nanos[i] = uint32_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+			}
+			for (std::size_t i = first; i < last; ++i)
+			{
+				auto start = std::chrono::steady_clock::now();
+				std::atomic_signal_fence(std::memory_order_seq_cst);
+				clockNanos[i] = uint32_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+			}
+			logger.waitUntilDrained();
+			auto start = std::chrono::steady_clock::now();
+			for (std::size_t i = first; i < last; ++i)
+			{
+				logger.log(fillFormat, uint32_t(i), int(i % 500), 100.25 + i % 7, "maker");
+			}
+			totalSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+		overflows = logger.overflowCount();
+	}
+	std::string text = sink.str();
+	std::size_t lines = std::count(text.begin(), text.end(), '\n');
+	std::cout << 2 * numCalls + 1 << " log calls in bursts of " << burst << ", " << lines << " lines written, " << overflows << " dropped" << std::endl;
+	printLatencyPercentiles("log call latency (including clock reads)", nanos);
+	printLatencyPercentiles("empty timed region (the clock reads alone)", clockNanos);
+	uint32_t clockOverhead = clockNanos[clockNanos.size() / 2];
+	for (uint32_t& n : nanos)
+	{
+		n = n > clockOverhead ? n - clockOverhead : 0;
+	}
+	printLatencyPercentiles("log call latency less the median clock overhead", nanos);
+	std::cout << "    mean " << totalSeconds * 1e9 / numCalls << " ns per log call without clock reads" << std::endl;
+
+	std::ostringstream floodSink;
+	std::vector<uint32_t> writtenNanos;  // a dropped call returns early and is much cheaper, so only calls that were written count
+	writtenNanos.reserve(numCalls);
+	uint64_t dropped = 0;
+	{
+		AsyncLogger logger(floodSink);
+		uint16_t fillFormat = logger.registerFormat("fill order {} qty {} @ {} ({})");
+		for (std::size_t i = 0; i < numCalls; ++i)
+		{
+			auto start = std::chrono::steady_clock::now();
+			std::atomic_signal_fence(std::memory_order_seq_cst);
+			logger.log(fillFormat, uint32_t(i), int(i % 500), 100.25 + i % 7, "maker");
+			std::atomic_signal_fence(std::memory_order_seq_cst);
+			uint32_t n = uint32_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+			uint64_t droppedSoFar = logger.overflowCount();
+			if (droppedSoFar == dropped) writtenNanos.push_back(n > clockOverhead ? n - clockOverhead : 0);
+			dropped = droppedSoFar;
+		}
+	}
+	text = floodSink.str();
+	lines = std::count(text.begin(), text.end(), '\n');
+	std::cout << numCalls << " log calls without pauses: " << lines << " written + " << dropped << " dropped = " << lines + dropped << std::endl;
+	printLatencyPercentiles("flood latency of the written calls less the median clock overhead", writtenNanos);
+}
 
 int main()
 {
@@ -196,5 +1327,38 @@ int main()
 	const auto int_fill_side = sideToInt(fill_side);
 	position += int_fill_side * fill_qty;
 	last_qty[int_fill_side + 1] = fill_qty;
-	std::cout << "last quantity: " << last_qty[int_fill_side + 1];
+	std::cout << "last quantity: " << last_qty[int_fill_side + 1] << std::endl;
+
+	OrderBook book(9'900, 10'100, 1'000);
+	book.addOrder(1, Side::BUY, 9'999, 100);
+	book.addOrder(2, Side::BUY, 9'999, 50);
+	book.addOrder(3, Side::SELL, 10'001, 70);
+	book.executeOrder(1, 100);
+	std::cout << "best bid " << book.bestBid() << " x " << book.levelQuantity(Side::BUY, book.bestBid())
+		<< ", best ask " << book.bestAsk() << " x " << book.levelQuantity(Side::SELL, book.bestAsk()) << std::endl;
+	benchmarkOrderBook(2'000'000);
+
+	MatchingEngine engine(9'900, 10'100, 1'000);
+	FillBuffer fills(64);
+	engine.submit({ 1, Side::SELL, OrderType::Limit, 10'001, 100 }, fills);
+	engine.submit({ 2, Side::SELL, OrderType::Limit, 10'002, 100 }, fills);
+	MatchStatus fok = engine.submit({ 3, Side::BUY, OrderType::FillOrKill, 10'002, 250 }, fills);  // only 200 available, so nothing trades
+	MatchStatus ioc = engine.submit({ 4, Side::BUY, OrderType::ImmediateOrCancel, 10'002, 150 }, fills);
+	std::cout << "fok status " << int(fok) << ", ioc status " << int(ioc) << " with " << fills.size() << " fills, best ask now "
+		<< engine.book().bestAsk() << " x " << engine.book().levelQuantity(Side::SELL, engine.book().bestAsk()) << std::endl;
+	benchmarkMatchingEngine(2'000'000);
+	benchmarkAllocators(10'000, 2'000'000);
+
+	{
+		AsyncLogger logger(std::cout);
+		uint16_t fillFormat = logger.registerFormat("demo fill: taker {} maker {} qty {} @ {}");
+		engine.submit({ 5, Side::SELL, OrderType::Limit, 10'002, 40 }, fills);
+		fills.clear();
+		engine.submit({ 6, Side::BUY, OrderType::Market, 0, 60 }, fills);
+		for (std::size_t i = 0; i < fills.size(); ++i)
+		{
+			logger.log(fillFormat, fills[i].taker, fills[i].maker, fills[i].quantity, fills[i].price);  // formatted off the hot path
+		}
+	}
+	benchmarkAsyncLogger(1'000'000);
 }
\ No newline at end of file
@@ -4,6 +4,10 @@
 # include <algorithm>
 # include <numbers>
 # include <cmath>
+# include <cstdint>
+# include <thread>
+# include <chrono>
+# include <bit>
 
 std::vector<int> v{ 1,2,3 };
 
@@ -15,6 +19,53 @@ std::size_t v_size = v.size();  // size_t means unsigned long int, enough bytes
 // enums are useful for switch statements
 
 
+// standard normal cdf and pdf, shared by everything below that needs them
+inline double norm_cdf(double x) { return 0.5 * (1.0 + std::erf(x / std::numbers::sqrt2)); }
+inline double norm_pdf(double x) { return std::numbers::inv_sqrtpi / std::numbers::sqrt2 * std::exp(-0.5 * x * x); }
+
+// std::exp and std::erf are library calls, gcc only swaps them for vector versions under -ffast-math, so a loop calling them runs scalar
+// exp_fast is plain arithmetic instead: e^x = 2^n * e^r with n the nearest integer to x / ln2 and |r| <= ln2 / 2
+// e^r is its taylor series up to r^11 (relative error around 1e-13) and 2^n is built directly in the exponent bits
+// valid for -708 <= x <= 709, finite inputs outside that are clamped
+inline double exp_fast(double x) {
+	constexpr double shifter = 0x1.8p52;  // adding this rounds to an integer, which then sits in the low bits of the mantissa
+	constexpr double c2 = 1.0 / 2, c3 = 1.0 / 6, c4 = 1.0 / 24, c5 = 1.0 / 120, c6 = 1.0 / 720, c7 = 1.0 / 5040,
+		c8 = 1.0 / 40320, c9 = 1.0 / 362880, c10 = 1.0 / 3628800, c11 = 1.0 / 39916800;  // 1 / k!
+
+	// clamp, written as arithmetic because gcc won't if-convert a floating point compare (it may trap on NaN) and then can't vectorise
+	// max(x, lo) = x + (|x - lo| - (x - lo)) / 2 and the correction terms are exactly 0 inside the range, so x is untouched there
+	double below = x + 708.0, above = x - 709.0;
+	x += 0.5 * (std::abs(below) - below) - 0.5 * (std::abs(above) + above);
+	double shifted = x * std::numbers::log2e + shifter;
+	double n = shifted - shifter;
+	double r = x - n * std::numbers::ln2;
+
+	double e_r = 1.0 + r * (1.0 + r * (c2 + r * (c3 + r * (c4 + r * (c5 + r * (c6 + r * (c7 + r * (c8 + r * (c9 + r * (c10 + r * c11))))))))));  // horner's rule
+	std::uint64_t two_n = (std::bit_cast<std::uint64_t>(shifted) + 1023) << 52;  // biased exponent n + 1023, mantissa 0
+	return e_r * std::bit_cast<double>(two_n);
+}
+
+inline double norm_pdf_fast(double x) { return std::numbers::inv_sqrtpi / std::numbers::sqrt2 * exp_fast(-0.5 * x * x); }
+
+// fast normal cdf, Abramowitz and Stegun 26.2.17, a degree 5 polynomial in t = 1 / (1 + p|x|) times the pdf
+// absolute error is below 7.5e-8 for every x, good enough for risk but not for implying vols off deep out of the money quotes
+// it needs one exp_fast and one division instead of erf, and has no branches, so a loop of these vectorises at -O3
+// callers that already have pdf(x) pass it in and skip the exp
+inline double norm_cdf_fast_from_pdf(double x, double pdf_x) {
+	constexpr double p = 0.2316419;
+	constexpr double b1 = 0.319381530, b2 = -0.356563782, b3 = 1.781477937, b4 = -1.821255978, b5 = 1.330274429;
+
+	double t = 1.0 / (1.0 + p * std::abs(x));
+	double poly = t * (b1 + t * (b2 + t * (b3 + t * (b4 + t * b5))));  // horner's rule
+	double upper_tail = pdf_x * poly;  // this is 1 - N(|x|)
+	double side = std::copysign(1.0, x);  // a sign rather than x >= 0 ? ... : ..., for the same reason as the clamp in exp_fast
+	return 0.5 * (1.0 + side) - side * upper_tail;  // N(-x) = 1 - N(x), exactly 1 - upper_tail or upper_tail
+}
+
+inline double norm_cdf_fast(double x) { return norm_cdf_fast_from_pdf(x, norm_pdf_fast(x)); }
+
+enum class NormCdfMethod { Erf, Fast };
+
 // lets try building a black scholes class
 // we can apply an enum class to represent a call or put option
 enum class PayoffType {
@@ -22,19 +73,31 @@ enum class PayoffType {
 	Put = -1
 };
 
+// price and greeks from one evaluation, the greeks share d1, d2, the discount factor and the cdf/pdf values with the price
+struct BlackScholesGreeks {
+	double price;
+	double delta, vega, theta, rho;  // first order
+	double gamma, vanna, volga, charm;  // second order, volga is also called vomma
+};
+
 class blackScholes {
 public:
 	blackScholes(double strike, double spot, double rate, double time_to_exp, PayoffType pot);  // define custom constructor
 	// the constructor takes in each of the required arguments except for volatility which is used by the () operator to compute and return price, which allows us to reuse the class later when computing the implied volatility numerically
-	double operator() (double vol);  // creates a functor, blackScholes() is now a function that can be called
+	double operator() (double vol) const;  // creates a functor, blackScholes() is now a function that can be called
+	BlackScholesGreeks greeks(double vol, NormCdfMethod method = NormCdfMethod::Erf) const;  // price and all the greeks in one call
+	// both are const and keep nothing in the object between calls, so one blackScholes can be shared by many threads
 
 private:
-	void compute_norm_args(double vol);  // compute d1 and d2
-	double strike_, spot_, rate_, time_to_exp_, sigma_;
+	struct NormArgs {
+		double d_1;
+		double d_2;
+		double vol_sqrt_time;
+	};
+	NormArgs compute_norm_args(double vol) const;  // compute d1 and d2, returned rather than stored so the object is never mutated
+	double strike_, spot_, rate_, time_to_exp_;
 	PayoffType pot_;
-	double d_1{ 0.0 };  // d1 with default value
-	double d_2{ 0.0 };  // d2 with default value
-}; // d1 and d2 can be given default values since the constructor initialiser list is only responsible for data members that depend on input parameters
+};
 
 
 blackScholes::blackScholes(double strike, double spot, double rate, double time_to_exp, PayoffType pot) 
@@ -42,30 +105,30 @@ blackScholes::blackScholes(double strike, double spot, double rate, double time_
 // good practice to initalise members at construction and in order they were declared
 
 // private helper function, compute norm args:
-void blackScholes::compute_norm_args(double vol) {
+blackScholes::NormArgs blackScholes::compute_norm_args(double vol) const {
 	
-	double numer = log(spot_ - strike_) + rate_ * time_to_exp_ + 0.5 * time_to_exp_ * vol * vol;
+	double numer = log(spot_ / strike_) + rate_ * time_to_exp_ + 0.5 * time_to_exp_ * vol * vol;
 
 	double vol_sqrt_time = vol * sqrt(time_to_exp_);
 
-	d_1 = numer / vol_sqrt_time;
+	double d_1 = numer / vol_sqrt_time;
 
-	d_2 = d_1 - vol_sqrt_time;
+	double d_2 = d_1 - vol_sqrt_time;
+
+	return { d_1, d_2, vol_sqrt_time };
 }
 
 
 
 // valueation of the option then begins with round bracket operator, taking volatility as input
 
-double blackScholes::operator() (double vol) {
+double blackScholes::operator() (double vol) const {
 	int phi = static_cast<int> (pot_);  // phi depends on the payoff type
 
 	double opt_price = 0.0;
 
 	if (time_to_exp_ > 0.0) {
-		compute_norm_args(vol);
-
-		auto norm_cdf = [](double x) -> double { return (1.0 + std::erf(x / 1.41421356)) / 2.0; };  // lambda for cumulative distribution function
+		auto [d_1, d_2, vol_sqrt_time] = compute_norm_args(vol);
 
 		double nd_1 = norm_cdf(phi * d_1); // +/-1 * d_1
 
@@ -73,7 +136,7 @@ double blackScholes::operator() (double vol) {
 
 		double disc_fctr = std::exp(-rate_ * time_to_exp_);  // discount factor
 
-		 opt_price = phi * (spot_ * nd_1 - strike_ * nd_2);
+		 opt_price = phi * (spot_ * nd_1 - disc_fctr * strike_ * nd_2);  // strike is paid at expiry so it has to be discounted
 	}
 
 	else {
@@ -83,6 +146,44 @@ double blackScholes::operator() (double vol) {
 	return opt_price;
 }
 
+// pricing and then bumping spot, vol, rate and time means around 10 full revaluations to get the greeks
+// analytically they all come out of the same few quantities, so we compute those once and build everything from them
+// theta is the derivative wrt calendar time (so it's usually negative), charm is the rate of change of delta wrt calendar time
+BlackScholesGreeks blackScholes::greeks(double vol, NormCdfMethod method) const {
+	double phi = static_cast<int> (pot_);
+	BlackScholesGreeks g{};
+
+	if (time_to_exp_ <= 0.0) {
+		g.price = std::max(phi * (spot_ - strike_), 0.0);  // only intrinsic value remains, everything but delta is zero
+		g.delta = g.price > 0.0 ? phi : 0.0;
+		return g;
+	}
+
+	auto [d_1, d_2, vol_sqrt_time] = compute_norm_args(vol);
+	auto cdf = method == NormCdfMethod::Fast ? norm_cdf_fast : norm_cdf;
+
+	double sqrt_time = std::sqrt(time_to_exp_);
+	double disc_fctr = std::exp(-rate_ * time_to_exp_);
+	double disc_strike = disc_fctr * strike_;
+	double nd_1 = cdf(phi * d_1);
+	double nd_2 = cdf(phi * d_2);
+	double pdf_d_1 = norm_pdf(d_1);  // the pdf is symmetric so this is the same for calls and puts
+
+	g.price = phi * (spot_ * nd_1 - disc_strike * nd_2);
+
+	g.delta = phi * nd_1;
+	g.vega = spot_ * pdf_d_1 * sqrt_time;
+	g.theta = -spot_ * pdf_d_1 * vol / (2.0 * sqrt_time) - phi * rate_ * disc_strike * nd_2;
+	g.rho = phi * time_to_exp_ * disc_strike * nd_2;
+
+	g.gamma = pdf_d_1 / (spot_ * vol_sqrt_time);
+	g.vanna = -pdf_d_1 * d_2 / vol;
+	g.volga = g.vega * d_1 * d_2 / vol;
+	g.charm = -pdf_d_1 * (2.0 * rate_ * time_to_exp_ - d_2 * vol_sqrt_time) / (2.0 * time_to_exp_ * vol_sqrt_time);
+
+	return g;
+}
+
 // using the payoff as an enum class and casting it allows us to avoid several extra lines in an if/else statement
 
 // function for calculation of implied volatility
@@ -116,12 +217,283 @@ double implied_volatility(blackScholes bsc, double opt_mkt_price, double x0, dou
 
 }
 
+// Implied volatility for a whole option chain
+// implied_volatility above solves one quote at a time, building a blackScholes object and running an open ended secant loop for each
+// for a vol surface refresh we have hundreds of thousands of quotes, so we want to
+// - store the chain as a structure of arrays, so the strikes, expiries and prices each sit contiguously in memory
+// - evaluate black scholes for several quotes at once in a loop the compiler can vectorise, using the fast cdf
+// - use newton's method, vega is the derivative of price wrt vol so we get it almost for free alongside the price
+// - keep a bracket [lo, hi] around the root, and fall back to bisection whenever newton would step outside it, so we always converge
+// - warm start each strike from its neighbour's solution, neighbouring strikes have similar vols so newton usually needs 2-3 steps
+// - polish each root with a few scalar newton steps on the exact (erf) price, so the fast cdf costs no accuracy
+
+// quote i is (strikes[i], expiries[i], mkt_prices[i]), quotes should be sorted by expiry then strike so neighbours are close
+struct OptionChain {
+	std::vector<double> strikes;
+	std::vector<double> expiries;
+	std::vector<double> mkt_prices;
+};
+
+constexpr std::size_t kChainLanes = 8;  // number of quotes evaluated together, one per SIMD lane
+
+// the state of the quotes currently in the lanes, one struct rather than separate arrays so the compiler knows the arrays don't overlap
+// (with separate pointers it would need a run time overlap check for every pair before it could vectorise)
+struct ChainLanes {
+	double log_moneyness[kChainLanes], disc_strike[kChainLanes], time_to_exp[kChainLanes], sqrt_time[kChainLanes];
+	double vol[kChainLanes], price[kChainLanes], vega[kChainLanes];
+};
+
+// price and vega for kChainLanes quotes at once with the fast cdf
+// the log moneyness, discounted strike and sqrt of time only depend on the quote, so they are computed once per quote, not per iteration
+// and spot * pdf(d_1) = disc_strike * pdf(d_2), so each lane needs a single exp_fast
+// what is left is arithmetic with no branches and no library calls, gcc vectorises it at -O2 (2 lanes per SSE2 register, 4 with AVX2)
+inline void black_scholes_price_vega_fast(double spot, double rate, double phi, ChainLanes& q) {
+
+	for (std::size_t l = 0; l < kChainLanes; ++l) {
+		double vol_sqrt_time = q.vol[l] * q.sqrt_time[l];
+		double d_1 = (q.log_moneyness[l] + (rate + 0.5 * q.vol[l] * q.vol[l]) * q.time_to_exp[l]) / vol_sqrt_time;
+		double d_2 = d_1 - vol_sqrt_time;
+		double pdf_d_1 = norm_pdf_fast(d_1);  // the pdf is symmetric so phi doesn't matter
+		double pdf_d_2 = pdf_d_1 * spot / q.disc_strike[l];
+
+		q.price[l] = phi * (spot * norm_cdf_fast_from_pdf(phi * d_1, pdf_d_1) - q.disc_strike[l] * norm_cdf_fast_from_pdf(phi * d_2, pdf_d_2));
+		q.vega[l] = spot * pdf_d_1 * q.sqrt_time[l];  // same for calls and puts
+	}
+}
+
+// returns the implied vol of every quote, NaN where the price is outside the no arbitrage bounds or we fail to converge
+// tol is on the vol, max_iter is per quote
+std::vector<double> implied_volatility_chain(double spot, double rate, PayoffType pot, const OptionChain& chain, double tol = 1e-10, unsigned max_iter = 100) {
+	constexpr double vol_lo = 1e-6;
+	constexpr double vol_hi = 5.0;
+	constexpr double fast_tol = 1e-8;  // the lanes only solve the fast cdf model this far, the polish does the rest
+
+	std::size_t n = chain.strikes.size();
+	std::vector<double> impl_vols(n, std::nan(" "));
+	if (n == 0) {
+		return impl_vols;
+	}
+	double phi = static_cast<int> (pot);
+
+	// the chain is cut into kChainLanes contiguous segments and lane l walks segment l strike by strike
+	// so every lane warm starts from the quote it has just solved, while all the lanes share one vectorised black scholes call per iteration
+	std::size_t lane_idx[kChainLanes], lane_end[kChainLanes];
+	unsigned lane_iter[kChainLanes];
+	double lane_lo[kChainLanes], lane_hi[kChainLanes];
+	ChainLanes q;
+
+	// moves lane l onto its next solvable quote, quotes outside the no arbitrage bounds have no implied vol and are left as NaN
+	auto start_quote = [&](std::size_t l, double warm_vol) {
+		for (; lane_idx[l] < lane_end[l]; ++lane_idx[l]) {
+			std::size_t i = lane_idx[l];
+			double k = chain.strikes[i], t = chain.expiries[i], p = chain.mkt_prices[i];
+			if (!(t > 0.0)) {
+				continue;
+			}
+			double disc_k = k * std::exp(-rate * t);
+			double lower = std::max(phi * (spot - disc_k), 0.0);
+			double upper = (pot == PayoffType::Call) ? spot : disc_k;
+			if (p > lower && p < upper) {
+				break;
+			}
+		}
+
+		lane_iter[l] = 0;
+		lane_lo[l] = vol_lo;
+		lane_hi[l] = vol_hi;
+
+		if (lane_idx[l] == lane_end[l]) {  // lane has finished, park it on a harmless dummy quote so the kernel stays branch free
+			q.log_moneyness[l] = 0.0;
+			q.disc_strike[l] = spot;
+			q.time_to_exp[l] = 1.0;
+			q.sqrt_time[l] = 1.0;
+			q.vol[l] = 0.2;
+			return;
+		}
+
+		std::size_t i = lane_idx[l];
+		q.log_moneyness[l] = std::log(spot / chain.strikes[i]);
+		q.disc_strike[l] = chain.strikes[i] * std::exp(-rate * chain.expiries[i]);
+		q.time_to_exp[l] = chain.expiries[i];
+		q.sqrt_time[l] = std::sqrt(q.time_to_exp[l]);
+		if (!(warm_vol > vol_lo && warm_vol < vol_hi)) {
+			// no neighbour to start from, use the Brenner-Subrahmanyam at the money approximation
+			warm_vol = std::sqrt(2.0 * std::numbers::pi / q.time_to_exp[l]) * chain.mkt_prices[i] / spot;
+			warm_vol = std::clamp(warm_vol, 0.05, 2.0);
+		}
+		q.vol[l] = warm_vol;
+	};
+
+	// the fast cdf is off by up to 7.5e-8, so the lane's root is close but not within tol of the true implied vol
+	// newton on the exact price from there (bracketed, with the same bisection fallback) needs one or two steps
+	// lane l still holds the quote's precomputed terms, so an exact evaluation is just the two erf and one exp
+	auto polish = [&](std::size_t l) {
+		double v = q.vol[l], lo = vol_lo, hi = vol_hi;
+		double mkt_price = chain.mkt_prices[lane_idx[l]];
+		for (unsigned iter = 0; iter <= max_iter; ++iter) {
+			double vol_sqrt_time = v * q.sqrt_time[l];
+			double d_1 = (q.log_moneyness[l] + (rate + 0.5 * v * v) * q.time_to_exp[l]) / vol_sqrt_time;
+			double d_2 = d_1 - vol_sqrt_time;
+			double diff = phi * (spot * norm_cdf(phi * d_1) - q.disc_strike[l] * norm_cdf(phi * d_2)) - mkt_price;
+			double vega = spot * norm_pdf(d_1) * q.sqrt_time[l];
+			if (std::abs(diff) <= tol * vega || hi - lo < tol) {
+				return v;
+			}
+			if (diff > 0.0) {
+				hi = v;
+			}
+			else {
+				lo = v;
+			}
+			double step = diff / vega;
+			double next = v - step;
+			if (!(next > lo && next < hi)) {
+				v = 0.5 * (lo + hi);
+				continue;
+			}
+			// after a newton step the error is about volga / (2 vega) * step^2, and volga / vega = d_1 d_2 / vol
+			// from the fast root that is usually far below tol, then we can stop without paying for another evaluation
+			if (0.5 * std::abs(d_1 * d_2 / v) * step * step < 0.1 * tol) {
+				return next;
+			}
+			v = next;
+		}
+		return std::nan(" ");
+	};
+
+	std::size_t active = 0;
+	for (std::size_t l = 0; l < kChainLanes; ++l) {
+		lane_idx[l] = l * n / kChainLanes;
+		lane_end[l] = (l + 1) * n / kChainLanes;
+		start_quote(l, std::nan(" "));
+		active += lane_idx[l] < lane_end[l];
+	}
+
+	while (active > 0) {
+		black_scholes_price_vega_fast(spot, rate, phi, q);
+
+		for (std::size_t l = 0; l < kChainLanes; ++l) {
+			if (lane_idx[l] == lane_end[l]) {
+				continue;
+			}
+
+			double diff = q.price[l] - chain.mkt_prices[lane_idx[l]];
+			// diff / vega is the size of the next newton step, i.e. roughly how far we are from the root in vol terms
+			bool converged = std::abs(diff) <= fast_tol * q.vega[l] || lane_hi[l] - lane_lo[l] < fast_tol;
+
+			if (converged || ++lane_iter[l] > max_iter) {
+				double solved = converged ? polish(l) : std::nan(" ");
+				impl_vols[lane_idx[l]] = solved;
+				++lane_idx[l];
+				start_quote(l, solved);  // warm start the neighbour, start_quote ignores a NaN
+				active -= lane_idx[l] == lane_end[l];
+				continue;
+			}
+
+			// price is increasing in vol, so the sign of the error tells us which side of the root we are on
+			if (diff > 0.0) {
+				lane_hi[l] = q.vol[l];
+			}
+			else {
+				lane_lo[l] = q.vol[l];
+			}
+
+			double next = q.vol[l] - diff / q.vega[l];  // newton step
+			if (!(next > lane_lo[l] && next < lane_hi[l])) {  // also catches vega == 0, where next is inf or NaN
+				next = 0.5 * (lane_lo[l] + lane_hi[l]);  // bisection fallback
+			}
+			q.vol[l] = next;
+		}
+	}
+
+	return impl_vols;
+}
+
+// throughput of the chain solver against solving the same quotes one by one with the secant implied_volatility
+void benchmark_implied_volatility_chain() {
+	const double spot = 100.0, rate = 0.03;
+	const std::size_t num_expiries = 20, num_strikes = 5000;
+
+	// synthetic chain priced off a smile, so we know the true vol of every quote
+	OptionChain chain;
+	std::vector<double> true_vols;
+	for (std::size_t e = 0; e < num_expiries; ++e) {
+		double t = 0.1 + 0.25 * e;
+		for (std::size_t k = 0; k < num_strikes; ++k) {
+			double strike = 60.0 + 80.0 * k / (num_strikes - 1);
+			double moneyness = std::log(strike / spot);
+			double vol = 0.2 - 0.1 * moneyness + 0.3 * moneyness * moneyness;
+			chain.strikes.push_back(strike);
+			chain.expiries.push_back(t);
+			chain.mkt_prices.push_back(blackScholes(strike, spot, rate, t, PayoffType::Call)(vol));
+			true_vols.push_back(vol);
+		}
+	}
+	std::size_t n = chain.strikes.size();
+
+	auto t0 = std::chrono::steady_clock::now();
+	std::vector<double> secant_vols(n);
+	for (std::size_t i = 0; i < n; ++i) {
+		blackScholes bsc(chain.strikes[i], spot, rate, chain.expiries[i], PayoffType::Call);
+		secant_vols[i] = implied_volatility(bsc, chain.mkt_prices[i], 0.1, 0.5, 1e-10, 100);
+	}
+	auto t1 = std::chrono::steady_clock::now();
+	std::vector<double> chain_vols = implied_volatility_chain(spot, rate, PayoffType::Call, chain);
+	auto t2 = std::chrono::steady_clock::now();
+
+	auto max_error = [&](const std::vector<double>& vols) {
+		double err = 0.0;
+		std::size_t failed = 0;
+		for (std::size_t i = 0; i < n; ++i) {
+			if (std::isnan(vols[i])) {
+				++failed;
+			}
+			else {
+				err = std::max(err, std::abs(vols[i] - true_vols[i]));
+			}
+		}
+		std::cout << " max vol error " << err << ", failed " << failed << std::endl;
+	};
+
+	double secant_secs = std::chrono::duration<double>(t1 - t0).count();
+	double chain_secs = std::chrono::duration<double>(t2 - t1).count();
+	std::cout << "secant: " << n / secant_secs << " quotes/s,";
+	max_error(secant_vols);
+	std::cout << "chain:  " << n / chain_secs << " quotes/s,";
+	max_error(chain_vols);
+}
+
 double GetOneGaussianBySummation();
 double GetOneGaussianByBoxMuller();
 
+// the sum of 12 uniforms on [0,1] has mean 6 and variance 1, so by the central limit theorem sum - 6 is roughly gaussian
+double GetOneGaussianBySummation() {
+	double result = 0;
+	for (unsigned long j = 0; j < 12; j++) {
+		result += rand() / static_cast<double>(RAND_MAX);
+	}
+	result -= 6.0;
+	return result;
+}
+
+// polar Box Muller: draw points in the square until one lands inside the unit circle (but not at the centre, where the log blows up)
+double GetOneGaussianByBoxMuller() {
+	double x;
+	double y;
+	double sizeSquared;
+	do {
+		x = 2.0 * rand() / static_cast<double>(RAND_MAX) - 1;
+		y = 2.0 * rand() / static_cast<double>(RAND_MAX) - 1;
+		sizeSquared = x * x + y * y;
+	} while (sizeSquared >= 1.0 || sizeSquared == 0.0);
+
+	return x * std::sqrt(-2 * std::log(sizeSquared) / sizeSquared);
+}
+
 
 // declare a simple implementation of a Monte Carlo call option pricer
 
+class PayOff;  // forward declaration, PayOff is defined below but we only need it by reference here
 double SimpleMonteCarlo(const PayOff& ThePayOff, double Expiry, double Strike, double Spot, double Vol, double r, unsigned long NumberOfPaths);
 
 // classes are much easier to design and think about if you map them to a real world object
@@ -136,6 +508,7 @@ public:
 	PayOff(double Strike_, OptionType TheOptionsType_);  // custom constructor
 	double operator() (double Spot) const;  // PayOff is a functor, returns a double, given the vaue of spot, the functor returns the payoff
 	// functor is const, it does not affect the PayOff object 
+	void operator() (const double* Spots, double* PayOffs, std::size_t n) const;  // block version, switches on the option type once per block rather than once per path
 private:
 	double Strike;  // make these private so we can control how external code can access them
 	OptionType TheOptionsType;
@@ -163,9 +536,35 @@ double PayOff::operator() (double spot) const {
 	}
 }
 
+// the block version hoists the switch out of the loop, each loop body is then a branchless max which the compiler can vectorise
+void PayOff::operator() (const double* Spots, double* PayOffs, std::size_t n) const {
+
+	switch (TheOptionsType)
+	{
+	case OptionType::Call:
+		for (std::size_t i = 0; i < n; ++i) {
+			PayOffs[i] = std::max(Spots[i] - Strike, 0.0);
+		}
+		break;
+
+	case OptionType::Put:
+		for (std::size_t i = 0; i < n; ++i) {
+			PayOffs[i] = std::max(Strike - Spots[i], 0.0);
+		}
+		break;
+
+	default:
+		throw("unknown option type found");
+	}
+}
+
 // now implement the monte carlo using a payoff object which has the strike hidden in it
 
-double SimpleMonteCarlo(const PayOff& ThePayOff, double Expiry, double Strike, double Spot, double Vol, double r, unsigned long NumberOfPaths) {
+// the strike lives inside the payoff object, the Strike argument is only kept so the signature matches the earlier version
+double SimpleMonteCarlo(const PayOff& ThePayOff, double Expiry, [[maybe_unused]] double Strike, double Spot, double Vol, double r, unsigned long NumberOfPaths) {
+	if (NumberOfPaths == 0) {
+		return 0.0;  // no paths, no estimate
+	}
 	double variance = Vol * Vol * Expiry;
 	double rootVariance = std::sqrt(variance);
 	double itoCorrection = -0.5 * variance;
@@ -187,6 +586,126 @@ double SimpleMonteCarlo(const PayOff& ThePayOff, double Expiry, double Strike, d
 }
 
 
+// Parallel Monte Carlo
+// SimpleMonteCarlo above draws one gaussian, takes one exp and evaluates one payoff per path, all on one thread
+// to scale across cores we split the paths into fixed size blocks, each block is an independent unit of work
+// inside a block we generate all the gaussians first, then do all the exps, then all the payoffs
+// each of these loops does the same thing to every element of an array, which is exactly the shape the compiler can vectorise (SIMD)
+// compile with -O3 (and -ffast-math so the compiler is allowed to use vectorised exp, log, sin and cos)
+
+// reproducibility: the random numbers for path i are a pure function of (seed, i), a counter based generator
+// so it doesn't matter which thread happens to simulate which block, every path always sees the same gaussian
+// each block's sum is written into its own slot and the slots are added up in block order at the end
+// floating point addition is not associative, so fixing the order of the additions is what makes the result bitwise identical for any number of threads
+
+constexpr std::size_t kPathBlockSize = 4096;  // paths per block, must not depend on the thread count
+
+// splitmix64 finaliser, mixes a 64 bit counter into a well distributed 64 bit number
+// it only uses multiplies, shifts and xors so a loop of these vectorises
+inline std::uint64_t MixCounter(std::uint64_t Seed, std::uint64_t Counter) {
+	std::uint64_t z = Seed + (Counter + 1) * 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+// top 53 bits turned into a double in (0,1], never 0 so the log in Box Muller is safe
+inline double CounterToUniform(std::uint64_t Seed, std::uint64_t Counter) {
+	return (static_cast<double>(MixCounter(Seed, Counter) >> 11) + 1.0) * (1.0 / 9007199254740992.0);
+}
+
+// fills Gaussians[0..n) for paths FirstPath .. FirstPath + n, n must be even
+// Box Muller turns two uniforms into two gaussians, so path 2k and 2k+1 share a pair of uniforms
+void GetGaussianBlockByBoxMuller(std::uint64_t Seed, std::uint64_t FirstPath, double* Gaussians, std::size_t n) {
+	constexpr double twoPi = 2.0 * std::numbers::pi;
+
+	for (std::size_t i = 0; i < n; i += 2) {
+		double u1 = CounterToUniform(Seed, FirstPath + i);
+		double u2 = CounterToUniform(Seed, FirstPath + i + 1);
+		double radius = std::sqrt(-2.0 * std::log(u1));
+		Gaussians[i] = radius * std::cos(twoPi * u2);
+		Gaussians[i + 1] = radius * std::sin(twoPi * u2);
+	}
+}
+
+// same inputs as SimpleMonteCarlo, plus how many threads to use and the seed of the random stream
+double ParallelMonteCarlo(const PayOff& ThePayOff, double Expiry, [[maybe_unused]] double Strike, double Spot, double Vol, double r, unsigned long NumberOfPaths,
+	unsigned NumberOfThreads = std::thread::hardware_concurrency(), std::uint64_t Seed = 20240101ULL) {
+
+	if (NumberOfPaths == 0) {
+		return 0.0;  // no paths, no estimate
+	}
+
+	double variance = Vol * Vol * Expiry;
+	double rootVariance = std::sqrt(variance);
+	double itoCorrection = -0.5 * variance;
+	double movedSpot = Spot * std::exp(r * Expiry + itoCorrection);
+
+	std::size_t numberOfBlocks = (NumberOfPaths + kPathBlockSize - 1) / kPathBlockSize;
+	std::vector<double> blockSums(numberOfBlocks, 0.0);  // one slot per block, written by exactly one thread so no locking is needed
+
+	if (NumberOfThreads == 0) {
+		NumberOfThreads = 1;  // hardware_concurrency() is allowed to return 0
+	}
+	NumberOfThreads = static_cast<unsigned>(std::min<std::size_t>(NumberOfThreads, std::max<std::size_t>(numberOfBlocks, 1)));
+
+	// each worker owns its scratch buffers, allocated once and reused for every block it simulates
+	auto worker = [&](unsigned threadIndex) {
+		std::vector<double> gaussians(kPathBlockSize);
+		std::vector<double> spots(kPathBlockSize);
+		std::vector<double> payOffs(kPathBlockSize);
+
+		for (std::size_t block = threadIndex; block < numberOfBlocks; block += NumberOfThreads) {  // blocks are dealt out round robin
+			std::uint64_t firstPath = static_cast<std::uint64_t>(block) * kPathBlockSize;
+			std::size_t pathsInBlock = std::min<std::size_t>(kPathBlockSize, NumberOfPaths - firstPath);
+			std::size_t evenPaths = (pathsInBlock + 1) & ~static_cast<std::size_t>(1);  // Box Muller works in pairs, a spare gaussian is just ignored
+
+			GetGaussianBlockByBoxMuller(Seed, firstPath, gaussians.data(), evenPaths);
+
+			for (std::size_t i = 0; i < pathsInBlock; ++i) {
+				spots[i] = movedSpot * std::exp(rootVariance * gaussians[i]);
+			}
+
+			ThePayOff(spots.data(), payOffs.data(), pathsInBlock);
+
+			double runningSum = 0.0;
+			for (std::size_t i = 0; i < pathsInBlock; ++i) {
+				runningSum += payOffs[i];
+			}
+			blockSums[block] = runningSum;
+		}
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(NumberOfThreads);
+	for (unsigned t = 0; t < NumberOfThreads; ++t) {
+		threads.emplace_back(worker, t);
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+
+	double runningSum = 0.0;
+	for (double blockSum : blockSums) {  // always summed in block order, whatever the thread count was
+		runningSum += blockSum;
+	}
+
+	double mean = runningSum / NumberOfPaths;
+	mean *= std::exp(-r * Expiry);
+	return mean;
+}
+
+
 int main() {
 	std::cout << "hi";
+
+	PayOff callPayOff(100.0, PayOff::OptionType::Call);
+	std::cout << "\nsimple monte carlo call price: " << SimpleMonteCarlo(callPayOff, 1.0, 100.0, 100.0, 0.2, 0.05, 1'000'000) << std::endl;
+	std::cout << "parallel monte carlo call price: " << ParallelMonteCarlo(callPayOff, 1.0, 100.0, 100.0, 0.2, 0.05, 1'000'000) << std::endl;
+
+	benchmark_implied_volatility_chain();
+
+	BlackScholesGreeks g = blackScholes(100.0, 100.0, 0.05, 1.0, PayoffType::Call).greeks(0.2);
+	std::cout << "price " << g.price << " delta " << g.delta << " gamma " << g.gamma << " vega " << g.vega
+		<< " theta " << g.theta << " rho " << g.rho << std::endl;
 }
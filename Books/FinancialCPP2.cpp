@@ -4,6 +4,10 @@
 # include <algorithm>
 # include <numbers>
 # include <cmath>
+# include <stdexcept>
+# include <variant>
+# include <random>
+# include <chrono>
 
 class PayOff {  // does almost nothing
 public:
@@ -46,7 +50,7 @@ public:
 	PayOffPut(double Strike_);
 	virtual double operator() (double Spot) const;
 	virtual ~PayOffPut() {}
-	PayOff* clone() const;
+	PayOffPut* clone() const;
 private:
 	double Strike;
 };
@@ -84,6 +88,148 @@ as the object now contains a lot of extra data */
 
 // using new should be avoided in time critical pieces of code!
 
+// Static dispatch for Monte Carlo inner loops
+// a Monte Carlo pricer calls the payoff once per path, with PayOff above that is one virtual call per path
+// the compiler can't see through the virtual call, so it can't inline the payoff and can't vectorise the loop around it
+// an enum + switch payoff (like the one in Finance CPP1) has the same problem, the branch is inside the loop
+// instead we can resolve the payoff at compile time with the curiously recurring template pattern (see Developing_HFT_1)
+// the base class knows its derived type, so it calls the derived PayOffAt() directly and the compiler can inline it
+
+template <typename Derived>
+class PayOffStatic {
+public:
+	double operator() (double Spot) const { return static_cast<const Derived*>(this)->PayOffAt(Spot); }
+
+	// whole array of spots at once, PayOffAt is inlined into the loop so the loop vectorises
+	void operator() (const double* Spots, double* PayOffs, std::size_t n) const
+	{
+		const Derived& payOff = static_cast<const Derived&>(*this);
+		for (std::size_t i = 0; i < n; ++i)
+		{
+			PayOffs[i] = payOff.PayOffAt(Spots[i]);
+		}
+	}
+};
+
+class PayOffCallStatic : public PayOffStatic<PayOffCallStatic> {
+public:
+	explicit PayOffCallStatic(double Strike_) : Strike(Strike_) {}
+	double PayOffAt(double Spot) const { return std::max(Spot - Strike, 0.0); }
+private:
+	double Strike;
+};
+
+class PayOffPutStatic : public PayOffStatic<PayOffPutStatic> {
+public:
+	explicit PayOffPutStatic(double Strike_) : Strike(Strike_) {}
+	double PayOffAt(double Spot) const { return std::max(Strike - Spot, 0.0); }
+private:
+	double Strike;
+};
+
+// when the payoff type is only known at runtime we can still keep the loop static
+// a std::variant holds one of the payoff types, and we std::visit it once per batch rather than once per path
+using PayOffVariant = std::variant<PayOffCallStatic, PayOffPutStatic>;
+
+// the Monte Carlo kernel, one instantiation per payoff type
+// takes a block of gaussians and returns the undiscounted sum of the payoffs, Scratch must hold n doubles
+template <typename PayOffType>
+double MonteCarloKernel(const PayOffType& ThePayOff, const double* Gaussians, double* Scratch, std::size_t n, double MovedSpot, double RootVariance)
+{
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		Scratch[i] = MovedSpot * std::exp(RootVariance * Gaussians[i]);
+	}
+
+	ThePayOff(Scratch, Scratch, n);  // payoffs overwrite the spots they were computed from
+
+	double runningSum = 0.0;
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		runningSum += Scratch[i];
+	}
+	return runningSum;
+}
+
+inline double MonteCarloKernel(const PayOffVariant& ThePayOff, const double* Gaussians, double* Scratch, std::size_t n, double MovedSpot, double RootVariance)
+{
+	return std::visit([&](const auto& payOff) { return MonteCarloKernel(payOff, Gaussians, Scratch, n, MovedSpot, RootVariance); }, ThePayOff);
+}
+
+// for the benchmark, the enum + switch payoff from Finance CPP1
+class PayOffSwitch {
+public:
+	enum class OptionType { Put, Call };
+	PayOffSwitch(double Strike_, OptionType TheOptionsType_) : Strike(Strike_), TheOptionsType(TheOptionsType_) {}
+	double operator() (double Spot) const
+	{
+		switch (TheOptionsType)
+		{
+		case OptionType::Call:
+			return std::max(Spot - Strike, 0.0);
+		case OptionType::Put:
+			return std::max(Strike - Spot, 0.0);
+		}
+		return 0.0;
+	}
+private:
+	double Strike;
+	OptionType TheOptionsType;
+};
+
+// sums the payoff over an array of spots calling the payoff once per spot, this is how SimpleMonteCarlo uses it
+template <typename PayOffType>
+double SumPayOffsPerPath(const PayOffType& ThePayOff, const std::vector<double>& Spots)
+{
+	double runningSum = 0.0;
+	for (double spot : Spots)
+	{
+		runningSum += ThePayOff(spot);
+	}
+	return runningSum;
+}
+
+// times the payoff evaluation alone for virtual, switch and static dispatch, the spots are simulated up front so only the dispatch differs
+// the payoff is picked at runtime so the compiler can't devirtualise the virtual version
+void BenchmarkPayOffDispatch(bool IsCall, double Strike)
+{
+	const std::size_t numberOfPaths = 1 << 22;
+	const int repeats = 20;
+
+	std::mt19937_64 generator(42);
+	std::normal_distribution<double> gaussian;
+	std::vector<double> gaussians(numberOfPaths), spots(numberOfPaths), scratch(numberOfPaths);
+	for (std::size_t i = 0; i < numberOfPaths; ++i)
+	{
+		gaussians[i] = gaussian(generator);
+		spots[i] = 100.0 * std::exp(0.2 * gaussians[i]);
+	}
+
+	PayOff* virtualPayOff = IsCall ? static_cast<PayOff*>(new PayOffCall(Strike)) : new PayOffPut(Strike);
+	PayOffSwitch switchPayOff(Strike, IsCall ? PayOffSwitch::OptionType::Call : PayOffSwitch::OptionType::Put);
+	PayOffVariant staticPayOff = IsCall ? PayOffVariant(PayOffCallStatic(Strike)) : PayOffVariant(PayOffPutStatic(Strike));
+
+	auto time = [&](const char* name, auto&& sumPayOffs) {
+		double total = 0.0;
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < repeats; ++r)
+		{
+			total += sumPayOffs();
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::cout << name << ": " << repeats * numberOfPaths / seconds / 1e6 << " M payoffs/s (mean " << total / (repeats * numberOfPaths) << ")" << std::endl;
+	};
+
+	// the switch can match static dispatch when everything is inlined into one function, because the optimiser hoists the switch out of the loop
+	// (loop unswitching), but that stops as soon as the payoff call isn't inlined, the static version doesn't rely on it
+	time("virtual", [&] { return SumPayOffsPerPath(*virtualPayOff, spots); });
+	time("switch ", [&] { return SumPayOffsPerPath(switchPayOff, spots); });
+	time("static ", [&] { return std::visit([&](const auto& payOff) { return SumPayOffsPerPath(payOff, spots); }, staticPayOff); });  // visited once, the loop inside is static
+	time("static kernel incl. exp", [&] { return MonteCarloKernel(staticPayOff, gaussians.data(), scratch.data(), numberOfPaths, 100.0, 0.2); });
+
+	delete virtualPayOff;
+}
+
 
 // Move onto Binomial Tree:
 /* s. The point of view we adopt is that a tree is
@@ -129,13 +275,253 @@ private:
 	double FinalTime;  
 };
 
-TreeProduct::TreeProduct(double FinalTime_) {
+TreeProduct::TreeProduct(double FinalTime_) : FinalTime(FinalTime_) {
 }
 
 double TreeProduct::GetFinalTime() const {
 	return FinalTime;
 }
 
+// the two products we need in practice, a european and an american option on any PayOff
+// each keeps its own copy of the pay-off via clone(), so the caller's PayOff can go out of scope
+class TreeEuropean : public TreeProduct {
+public:
+	TreeEuropean(double FinalTime, const PayOff& ThePayOff_);
+	TreeEuropean(const TreeEuropean& original);
+	TreeEuropean& operator= (const TreeEuropean& original);
+	virtual ~TreeEuropean();
+	virtual double FinalPayOff(double Spot) const;
+	virtual double PreFinalValue(double Spot, double Time, double DiscountedFutureValue) const;
+	virtual TreeProduct* clone() const;
+
+private:
+	PayOff* ThePayOff;
+};
+
+TreeEuropean::TreeEuropean(double FinalTime, const PayOff& ThePayOff_) : TreeProduct(FinalTime), ThePayOff(ThePayOff_.clone()) {}
+
+TreeEuropean::TreeEuropean(const TreeEuropean& original) : TreeProduct(original), ThePayOff(original.ThePayOff->clone()) {}
+
+TreeEuropean& TreeEuropean::operator= (const TreeEuropean& original) {
+	if (this != &original)
+	{
+		TreeProduct::operator=(original);
+		PayOff* copy = original.ThePayOff->clone();
+		delete ThePayOff;
+		ThePayOff = copy;
+	}
+	return *this;
+}
+
+TreeEuropean::~TreeEuropean() {
+	delete ThePayOff;
+}
+
+double TreeEuropean::FinalPayOff(double Spot) const {
+	return (*ThePayOff)(Spot);
+}
+
+double TreeEuropean::PreFinalValue(double /*Spot*/, double /*Time*/, double DiscountedFutureValue) const {
+	return DiscountedFutureValue;  // no early exercise, so the value is just the discounted expectation
+}
+
+TreeProduct* TreeEuropean::clone() const {
+	return new TreeEuropean(*this);
+}
+
+class TreeAmerican : public TreeProduct {
+public:
+	TreeAmerican(double FinalTime, const PayOff& ThePayOff_);
+	TreeAmerican(const TreeAmerican& original);
+	TreeAmerican& operator= (const TreeAmerican& original);
+	virtual ~TreeAmerican();
+	virtual double FinalPayOff(double Spot) const;
+	virtual double PreFinalValue(double Spot, double Time, double DiscountedFutureValue) const;
+	virtual TreeProduct* clone() const;
+
+private:
+	PayOff* ThePayOff;
+};
+
+TreeAmerican::TreeAmerican(double FinalTime, const PayOff& ThePayOff_) : TreeProduct(FinalTime), ThePayOff(ThePayOff_.clone()) {}
+
+TreeAmerican::TreeAmerican(const TreeAmerican& original) : TreeProduct(original), ThePayOff(original.ThePayOff->clone()) {}
+
+TreeAmerican& TreeAmerican::operator= (const TreeAmerican& original) {
+	if (this != &original)
+	{
+		TreeProduct::operator=(original);
+		PayOff* copy = original.ThePayOff->clone();
+		delete ThePayOff;
+		ThePayOff = copy;
+	}
+	return *this;
+}
+
+TreeAmerican::~TreeAmerican() {
+	delete ThePayOff;
+}
+
+double TreeAmerican::FinalPayOff(double Spot) const {
+	return (*ThePayOff)(Spot);
+}
+
+double TreeAmerican::PreFinalValue(double Spot, double /*Time*/, double DiscountedFutureValue) const {
+	return std::max((*ThePayOff)(Spot), DiscountedFutureValue);  // exercise if and only if it's worth more than holding on
+}
+
+TreeProduct* TreeAmerican::clone() const {
+	return new TreeAmerican(*this);
+}
+
+// The lattice engine
+// the tree is built once (node placement, probabilities, discounting) and then any number of products are valued on it
+// we work with log spot, so every node sits on an evenly spaced level j * dx around today's spot
+// a recombining tree with N steps only ever visits the 2N + 1 levels -N .. N, so we store one spot per level in a flat array
+// rather than a spot per node, the spot at (step, level) is just LevelSpots[level + N]
+// for the backward induction we keep one row of values per product and overwrite it in place as we step back in time
+// so memory is O(steps) per product instead of storing the whole O(steps^2) tree
+// and all the products are rolled back together in the same pass over the time steps
+
+enum class LatticeType { Binomial, Trinomial };
+
+class Lattice {
+public:
+	Lattice(double Spot_, double r_, double d_, double Vol_, unsigned long Steps_, double Time_, LatticeType Type_ = LatticeType::Binomial);
+
+	// values every product in one backward pass, all the products must expire at the lattice's final time
+	std::vector<double> GetThePrices(const std::vector<const TreeProduct*>& Products) const;
+	double GetThePrice(const TreeProduct& Product) const;
+
+private:
+	unsigned long NodesAtStep(unsigned long Step) const;
+	long LevelOfNode(unsigned long Step, unsigned long Node) const;
+
+	double Spot, r, d, Vol, Time;
+	unsigned long Steps;
+	LatticeType Type;
+
+	double pUp, pMid, pDown;  // pMid is zero on a binomial tree
+	double Discount;  // one step discount factor
+	std::vector<double> LevelSpots;  // 2 * Steps + 1 spots, one per log spot level
+	std::vector<double> StepTimes;  // Steps + 1 times
+};
+
+Lattice::Lattice(double Spot_, double r_, double d_, double Vol_, unsigned long Steps_, double Time_, LatticeType Type_)
+	: Spot(Spot_), r(r_), d(d_), Vol(Vol_), Time(Time_), Steps(Steps_), Type(Type_)
+{
+	if (Steps == 0)
+	{
+		throw std::invalid_argument("a lattice needs at least one step");
+	}
+
+	double dt = Time / Steps;
+	double nu = r - d - 0.5 * Vol * Vol;  // drift of log spot
+	double dx;
+
+	if (Type == LatticeType::Binomial)
+	{
+		// up and down moves of +/- dx, the probability is tilted so the mean of log spot matches the drift
+		dx = Vol * std::sqrt(dt);
+		pUp = 0.5 + 0.5 * nu * dt / dx;
+		pMid = 0.0;
+		pDown = 1.0 - pUp;
+	}
+	else
+	{
+		// up, flat and down moves, with dx chosen so the three probabilities match the first two moments and stay positive
+		dx = Vol * std::sqrt(3.0 * dt);
+		double secondMoment = (Vol * Vol * dt + nu * nu * dt * dt) / (dx * dx);
+		pUp = 0.5 * (secondMoment + nu * dt / dx);
+		pDown = 0.5 * (secondMoment - nu * dt / dx);
+		pMid = 1.0 - pUp - pDown;
+	}
+	Discount = std::exp(-r * dt);
+
+	LevelSpots.resize(2 * Steps + 1);
+	for (unsigned long i = 0; i < LevelSpots.size(); ++i)
+	{
+		LevelSpots[i] = Spot * std::exp((static_cast<long>(i) - static_cast<long>(Steps)) * dx);
+	}
+
+	StepTimes.resize(Steps + 1);
+	for (unsigned long i = 0; i <= Steps; ++i)
+	{
+		StepTimes[i] = i * dt;
+	}
+}
+
+inline unsigned long Lattice::NodesAtStep(unsigned long Step) const
+{
+	return Type == LatticeType::Binomial ? Step + 1 : 2 * Step + 1;
+}
+
+// node 0 is the lowest node at each step, on a binomial tree neighbouring nodes are two levels apart
+inline long Lattice::LevelOfNode(unsigned long Step, unsigned long Node) const
+{
+	long step = static_cast<long>(Step), node = static_cast<long>(Node);
+	return Type == LatticeType::Binomial ? 2 * node - step : node - step;
+}
+
+std::vector<double> Lattice::GetThePrices(const std::vector<const TreeProduct*>& Products) const
+{
+	for (const TreeProduct* product : Products)
+	{
+		if (std::abs(product->GetFinalTime() - Time) > 1e-12 * std::max(1.0, Time))
+		{
+			throw std::invalid_argument("product expiry does not match the lattice");
+		}
+	}
+
+	std::size_t numberOfProducts = Products.size();
+	std::size_t width = NodesAtStep(Steps);
+	std::vector<double> Values(numberOfProducts * width);  // one rolling row per product, laid out back to back
+
+	for (std::size_t p = 0; p < numberOfProducts; ++p)
+	{
+		double* row = &Values[p * width];
+		for (unsigned long node = 0; node < width; ++node)
+		{
+			row[node] = Products[p]->FinalPayOff(LevelSpots[LevelOfNode(Steps, node) + Steps]);
+		}
+	}
+
+	// node k at step i has children k, k+1 (binomial) or k, k+1, k+2 (trinomial) at step i+1
+	// so sweeping k upwards we only ever overwrite a value after both of its parents have read it, which is why one row is enough
+	for (unsigned long step = Steps; step-- > 0;)
+	{
+		double t = StepTimes[step];
+		unsigned long nodes = NodesAtStep(step);
+
+		for (std::size_t p = 0; p < numberOfProducts; ++p)
+		{
+			double* row = &Values[p * width];
+			const TreeProduct& product = *Products[p];
+
+			for (unsigned long node = 0; node < nodes; ++node)
+			{
+				double expectation = (Type == LatticeType::Binomial)
+					? pDown * row[node] + pUp * row[node + 1]
+					: pDown * row[node] + pMid * row[node + 1] + pUp * row[node + 2];
+				double spot = LevelSpots[LevelOfNode(step, node) + Steps];
+				row[node] = product.PreFinalValue(spot, t, Discount * expectation);
+			}
+		}
+	}
+
+	std::vector<double> Prices(numberOfProducts);
+	for (std::size_t p = 0; p < numberOfProducts; ++p)
+	{
+		Prices[p] = Values[p * width];  // the single node at step 0
+	}
+	return Prices;
+}
+
+double Lattice::GetThePrice(const TreeProduct& Product) const
+{
+	return GetThePrices({ &Product })[0];
+}
+
 // what we would like is a pay-off class that has polymorphic features while taking care of its own memory management
 // this can be done with a templated wrapper class or using the bridge pattern
 // bridge pattern implemented by taking the vanillaoption class and removing the Expiry member and the GetExpiry() function so we're left with a class that stores a pointer to an option pay-off and takes care of memory handling
@@ -200,6 +586,23 @@ int main() {
 		ptr = new PayOffPut(strike);
 	}
 	delete ptr;
+
+	BenchmarkPayOffDispatch(n == 0, strike);
+
+	// a whole strike ladder of american puts valued on one tree
+	Lattice tree(100.0, 0.05, 0.0, 0.2, 1000, 1.0);
+	std::vector<TreeAmerican> ladder;
+	for (double k = 80.0; k <= 120.0; k += 5.0) {
+		ladder.emplace_back(1.0, PayOffPut(k));
+	}
+	std::vector<const TreeProduct*> products;
+	for (const TreeAmerican& option : ladder) {
+		products.push_back(&option);
+	}
+	std::vector<double> prices = tree.GetThePrices(products);
+	for (std::size_t i = 0; i < prices.size(); ++i) {
+		std::cout << "american put strike " << 80.0 + 5.0 * i << " price " << prices[i] << std::endl;
+	}
 	/*  At this
 point we must be careful: we have a pointer to a base object, so which destructor
 will it call? If the destructor is not virtual then it will call the base class destructor. If the object is of an inherited class this may cause problems as the object will
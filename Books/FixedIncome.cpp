@@ -2,6 +2,11 @@
 # include <vector>
 # include <cmath>
 # include <string>
+# include <algorithm>
+# include <thread>
+# include <chrono>
+# include <random>
+# include <stdexcept>
 
 // lets calculate a simple interest rate
 // interest rates determine how much a financial institution will pay in exchange for holding a cash deposit over a period of time
@@ -124,6 +129,8 @@ double CompoundIntRateCalculator::continousCompounding(double value, int numPeri
 // PV is the desired present value, FV is the future value that we want to discount
 // R is interest rate and N is number of periods
 
+class YieldCurve;
+
 class CashFlowCalculator {
 public:
 	CashFlowCalculator(double rate);
@@ -132,10 +139,12 @@ public:
 	~CashFlowCalculator();
 	void addCashPayment(double value, int timePeriod);  // add new payments to the cash flow
 	double presentValue();
+	double presentValue(const YieldCurve& curve);  // discount with a curve instead of the flat m_rate
 private:
 	std::vector<double> m_cashPayments;
 	std::vector<int> m_timePeriods;
 	double m_rate;
+	std::vector<double> m_discountFactors;  // 1 / (1 + m_rate)^N for each period N seen so far, NaN until first needed
 	double presentValue(double futureValue, int timePeriod);  // used to compute the PV or the whole cash flow stored in the current object
 };
 
@@ -144,7 +153,8 @@ CashFlowCalculator::CashFlowCalculator(double rate) : m_rate(rate)
 
 }
 
-CashFlowCalculator::CashFlowCalculator(const CashFlowCalculator& v) : m_rate(v.m_rate)
+CashFlowCalculator::CashFlowCalculator(const CashFlowCalculator& v) : m_cashPayments(v.m_cashPayments), m_timePeriods(v.m_timePeriods), m_rate(v.m_rate),
+	m_discountFactors(v.m_discountFactors)
 {
 
 }
@@ -161,6 +171,7 @@ CashFlowCalculator& CashFlowCalculator::operator=(const CashFlowCalculator& v)
 		this->m_cashPayments = v.m_cashPayments;
 		this->m_rate = v.m_rate;
 		this->m_timePeriods = v.m_timePeriods;
+		this->m_discountFactors = v.m_discountFactors;
 	}
 	return *this;
 }
@@ -186,9 +197,161 @@ void CashFlowCalculator::addCashPayment(double value, int timePeriod)
 double CashFlowCalculator::presentValue(double futureValue, int timeperiod)
 {
 	// function just for calculating the PV for a single payment
-	double pValue = futureValue / std::pow(1 + m_rate, timeperiod);
-	std::cout << " value " << pValue << std::endl;
-	return pValue;
+	// std::pow is only called the first time a period is seen, and there is no I/O here since this runs once per cash flow
+	// a payment dated before today (a negative period) isn't worth caching, it's valued directly
+	if (timeperiod < 0)
+	{
+		return futureValue / std::pow(1 + m_rate, timeperiod);
+	}
+	if (timeperiod >= static_cast<int>(m_discountFactors.size()))
+	{
+		m_discountFactors.resize(timeperiod + 1, std::nan(""));
+	}
+	double& discountFactor = m_discountFactors[timeperiod];
+	if (std::isnan(discountFactor))
+	{
+		discountFactor = 1 / std::pow(1 + m_rate, timeperiod);
+	}
+	return futureValue * discountFactor;
+}
+
+// Yield curves and bulk present value
+// a single flat rate is rarely right, the rate for money lent for 1 period is different from the rate for 10 periods
+// a yield curve gives a zero rate for each period, the discount factor for period N is then 1 / (1 + R_N)^N
+// the curve is defined by a few pillar periods, rates in between are interpolated linearly and held flat beyond the ends
+
+class YieldCurve {
+public:
+	YieldCurve(double flatRate);
+	YieldCurve(const std::vector<int>& periods, const std::vector<double>& rates);  // periods must be increasing, throws std::invalid_argument if not
+
+	double zeroRate(int period) const;
+	double discountFactor(int period) const;
+
+private:
+	std::vector<int> m_periods;
+	std::vector<double> m_rates;
+};
+
+YieldCurve::YieldCurve(double flatRate) : m_periods{ 0 }, m_rates{ flatRate }
+{
+
+}
+
+YieldCurve::YieldCurve(const std::vector<int>& periods, const std::vector<double>& rates) : m_periods(periods), m_rates(rates)
+{
+	// zeroRate reads the first and last pillars and binary searches the rest, so a malformed curve would read garbage
+	if (m_periods.empty() || m_periods.size() != m_rates.size())
+	{
+		throw std::invalid_argument("a yield curve needs one rate for each of at least one pillar period");
+	}
+	if (std::adjacent_find(m_periods.begin(), m_periods.end(), [](int a, int b) { return a >= b; }) != m_periods.end())
+	{
+		throw std::invalid_argument("yield curve pillar periods must be strictly increasing");
+	}
+}
+
+double YieldCurve::zeroRate(int period) const
+{
+	if (period <= m_periods.front()) return m_rates.front();
+	if (period >= m_periods.back()) return m_rates.back();
+
+	std::size_t i = std::upper_bound(m_periods.begin(), m_periods.end(), period) - m_periods.begin();  // first pillar after period
+	double w = double(period - m_periods[i - 1]) / (m_periods[i] - m_periods[i - 1]);
+	return (1 - w) * m_rates[i - 1] + w * m_rates[i];
+}
+
+double YieldCurve::discountFactor(int period) const
+{
+	return std::pow(1 + zeroRate(period), -period);
+}
+
+// a bulk valuation only has a few distinct periods (e.g. 1..360 months) but millions of cash flows
+// so we compute each distinct discount factor once into a table, valuing a cash flow is then a lookup and a multiply
+// the table covers minPeriod..maxPeriod, so a schedule that still holds a payment dated before today (a negative period) can be looked up too
+class DiscountFactorTable {
+public:
+	DiscountFactorTable(const YieldCurve& curve, int maxPeriod, int minPeriod = 0);
+	double operator[] (int period) const { return m_factors[period - m_minPeriod]; }
+	int minPeriod() const { return m_minPeriod; }
+	int maxPeriod() const { return m_minPeriod + static_cast<int>(m_factors.size()) - 1; }
+
+private:
+	int m_minPeriod;
+	std::vector<double> m_factors;
+};
+
+DiscountFactorTable::DiscountFactorTable(const YieldCurve& curve, int maxPeriod, int minPeriod) : m_minPeriod(minPeriod), m_factors(maxPeriod - minPeriod + 1)
+{
+	for (int period = minPeriod; period <= maxPeriod; ++period)
+	{
+		m_factors[period - minPeriod] = curve.discountFactor(period);
+	}
+}
+
+// one schedule of cash flows stored as two parallel arrays, amounts[i] is paid at periods[i]
+struct CashFlowSchedule {
+	std::vector<double> amounts;
+	std::vector<int> periods;
+};
+
+// present value of every schedule, the discount table is built once and then only read, so the threads share it without locking
+// each schedule's loop is a gather from the table and a multiply add, with no function calls and no I/O
+std::vector<double> presentValues(const std::vector<CashFlowSchedule>& schedules, const YieldCurve& curve, unsigned numThreads = std::thread::hardware_concurrency())
+{
+	int minPeriod = 0, maxPeriod = 0;
+	for (const CashFlowSchedule& schedule : schedules)
+	{
+		for (int period : schedule.periods)
+		{
+			minPeriod = std::min(minPeriod, period);
+			maxPeriod = std::max(maxPeriod, period);
+		}
+	}
+	DiscountFactorTable factors(curve, maxPeriod, minPeriod);
+
+	std::vector<double> values(schedules.size());
+	auto valueRange = [&](std::size_t begin, std::size_t end) {
+		for (std::size_t s = begin; s < end; ++s)
+		{
+			const double* amounts = schedules[s].amounts.data();
+			const int* periods = schedules[s].periods.data();
+			std::size_t n = schedules[s].amounts.size();
+			double total = 0;
+			for (std::size_t i = 0; i < n; ++i)
+			{
+				total += amounts[i] * factors[periods[i]];
+			}
+			values[s] = total;
+		}
+	};
+
+	numThreads = std::max(1u, numThreads);
+	std::vector<std::thread> threads;
+	for (unsigned t = 1; t < numThreads; ++t)
+	{
+		threads.emplace_back(valueRange, t * schedules.size() / numThreads, (t + 1) * schedules.size() / numThreads);
+	}
+	valueRange(0, schedules.size() / numThreads);
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+	return values;
+}
+
+// the same table as the bulk valuation, so each distinct period costs one std::pow however many payments fall on it
+double CashFlowCalculator::presentValue(const YieldCurve& curve)
+{
+	if (m_timePeriods.empty()) return 0;
+	auto [minPeriod, maxPeriod] = std::minmax_element(m_timePeriods.begin(), m_timePeriods.end());
+	DiscountFactorTable factors(curve, *maxPeriod, *minPeriod);
+	double total = 0;
+	for (std::size_t i = 0; i < m_cashPayments.size(); ++i)
+	{
+		total += m_cashPayments[i] * factors[m_timePeriods[i]];
+	}
+	return total;
 }
 
 // Bonds are a very common fixed income instrument
@@ -196,6 +359,21 @@ double CashFlowCalculator::presentValue(double futureValue, int timeperiod)
 // this principal is often repaid at expiry
 // between the start period and expiry, investors are paid a constant value, called the coupon value, which determines the interest rate paid on the bond
 
+// yield to maturity is the single rate y that discounts the bond's cash flows back to its market price
+// P(y) = sum over k of C / (1 + y)^k + F / (1 + y)^N, where C is the coupon per period and F the principal
+// there is no closed form so we solve P(y) = price with Newton-Raphson, using the analytic derivative
+// P'(y) = -sum k * CF_k / (1 + y)^(k+1), and P''(y) = sum k (k+1) * CF_k / (1 + y)^(k+2)
+// modified duration is -P'/P (the % price change per unit of yield) and convexity is P''/P (how that sensitivity bends)
+// all three come out of the same loop over the cash flows, so the last Newton pass gives the risk numbers for free
+
+struct BondAnalytics {
+	double yield = 0;
+	double modifiedDuration = 0;
+	double convexity = 0;
+	int iterations = 0;
+	bool converged = false;
+};
+
 class BondCalculator {
 public:
 	BondCalculator(const std::string institution, int numPeriods, double principal, double couponValue);
@@ -204,20 +382,30 @@ public:
 	~BondCalculator();
 
 	double interestRate();  // used to return the internal rate of return implied by the coupon
+	double price(double yield) const;
+	BondAnalytics analytics(double marketPrice, double tolerance = 1e-12, int maxIterations = 50) const;  // solves for the YTM at marketPrice
 
 private:
 	std::string m_institution;
 	double m_principal;
 	double m_coupon;
 	int m_numPeriods;
+
+	struct PriceDerivatives {
+		double price;
+		double first;
+		double second;
+	};
+	PriceDerivatives priceDerivatives(double yield) const;
 };
 
 BondCalculator::BondCalculator(const std::string institution, int numPeriods, double principal, double couponValue)
+	: m_institution(institution), m_principal(principal), m_coupon(couponValue), m_numPeriods(numPeriods)
 {
 
 }
 
-BondCalculator::BondCalculator(const BondCalculator& v) : m_institution(v.m_institution), m_numPeriods(v.m_numPeriods), m_principal(v.m_principal), m_coupon(v.m_coupon)
+BondCalculator::BondCalculator(const BondCalculator& v) : m_institution(v.m_institution), m_principal(v.m_principal), m_coupon(v.m_coupon), m_numPeriods(v.m_numPeriods)
 {
 
 }
@@ -244,6 +432,257 @@ double BondCalculator::interestRate()
 	return m_coupon / m_principal;
 }
 
+BondCalculator::PriceDerivatives BondCalculator::priceDerivatives(double yield) const
+{
+	// v^k is built up by multiplying, so each period costs a few multiplies and no std::pow
+	double v = 1 / (1 + yield);
+	double vk = 1;  // v^k
+	double price = 0, first = 0, second = 0;
+	for (int k = 1; k <= m_numPeriods; ++k)
+	{
+		vk *= v;
+		double cashFlow = (k == m_numPeriods) ? m_coupon + m_principal : m_coupon;
+		price += cashFlow * vk;
+		first += k * cashFlow * vk;
+		second += k * (k + 1.0) * cashFlow * vk;
+	}
+	return { price, -first * v, second * v * v };
+}
+
+double BondCalculator::price(double yield) const
+{
+	return priceDerivatives(yield).price;
+}
+
+BondAnalytics BondCalculator::analytics(double marketPrice, double tolerance, int maxIterations) const
+{
+	BondAnalytics result;
+	if (m_numPeriods <= 0 || marketPrice <= 0) return result;
+
+	// the usual approximate YTM, (coupon + straight line pull to par) / average of price and par, starts Newton very close
+	double yield = (m_coupon + (m_principal - marketPrice) / m_numPeriods) / ((m_principal + marketPrice) / 2);
+	yield = std::max(yield, -0.5);
+
+	for (int i = 0; i < maxIterations; ++i)
+	{
+		PriceDerivatives p = priceDerivatives(yield);
+		result.iterations = i + 1;
+		double diff = p.price - marketPrice;
+		if (std::abs(diff) <= tolerance * marketPrice)
+		{
+			result.converged = true;
+			result.yield = yield;
+			result.modifiedDuration = -p.first / p.price;
+			result.convexity = p.second / p.price;
+			return result;
+		}
+		// P is decreasing and convex in y so Newton converges from most starts, we only guard against stepping below y = -1
+		double step = diff / p.first;
+		while (yield - step <= -1)
+		{
+			step /= 2;
+		}
+		yield -= step;
+	}
+	result.yield = yield;
+	return result;
+}
+
+// solve a whole portfolio, bonds are independent so each thread takes a contiguous slice and writes only its own results
+std::vector<BondAnalytics> solveBondAnalytics(const std::vector<BondCalculator>& bonds, const std::vector<double>& prices,
+	unsigned numThreads = std::thread::hardware_concurrency())
+{
+	std::vector<BondAnalytics> results(bonds.size());
+	auto solveRange = [&](std::size_t begin, std::size_t end) {
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			results[i] = bonds[i].analytics(prices[i]);
+		}
+	};
+
+	numThreads = std::max(1u, numThreads);
+	std::vector<std::thread> threads;
+	for (unsigned t = 1; t < numThreads; ++t)
+	{
+		threads.emplace_back(solveRange, t * bonds.size() / numThreads, (t + 1) * bonds.size() / numThreads);
+	}
+	solveRange(0, bonds.size() / numThreads);
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+	return results;
+}
+
+void benchmarkBondAnalytics(int numBonds)
+{
+	// random semi annual bonds of 1 to 30 years, priced off a known yield so we can check the solver gets it back
+	std::mt19937_64 gen(42);
+	std::uniform_int_distribution<int> periods(2, 60);
+	std::uniform_real_distribution<double> coupons(0.0, 5.0), yields(0.0, 0.05);
+	std::vector<BondCalculator> bonds;
+	std::vector<double> prices, trueYields;
+	bonds.reserve(numBonds);
+	for (int i = 0; i < numBonds; ++i)
+	{
+		bonds.emplace_back("bond", periods(gen), 100.0, coupons(gen));
+		trueYields.push_back(yields(gen));
+		prices.push_back(bonds.back().price(trueYields.back()));
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<BondAnalytics> results = solveBondAnalytics(bonds, prices);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	double maxError = 0;
+	int failures = 0;
+	for (int i = 0; i < numBonds; ++i)
+	{
+		maxError = std::max(maxError, std::abs(results[i].yield - trueYields[i]));
+		failures += !results[i].converged;
+	}
+	std::cout << numBonds << " bonds in " << seconds * 1e3 << " ms, " << numBonds / seconds << " bonds/s, max yield error "
+		<< maxError << ", not converged " << failures << std::endl;
+}
+
+// Bootstrapping a zero curve
+// the market doesn't quote zero rates directly, it quotes deposits (short end) and coupon bonds (long end)
+// bootstrapping walks along the instruments in maturity order, each one adds a single new pillar to the curve
+// a deposit with simple rate R for t years gives DF(t) = 1 / (1 + R t), which is just IntRateCalculator(R t) for one period
+// a coupon bond's price is sum of coupon * DF(t_i) + principal * DF(T), every DF before the previous pillar is already known,
+// so the only unknown is DF(T) and we solve for it with a 1D Newton iteration
+// we store ln DF at each tenor and interpolate linearly in ln DF, which means the forward rate is constant between pillars
+
+struct DepositQuote {
+	double tenor;  // in years
+	double rate;   // simple annual rate
+};
+
+struct BondQuote {
+	double maturity;  // in years
+	double coupon;    // annual coupon rate, paid frequency times a year on a principal of 100
+	double price;     // dirty price per 100
+	int frequency;
+};
+
+// a single query finds its segment with a binary search, so a const curve holds no state and can be shared between threads
+// discountFactors keeps a cursor on the current segment for the length of one call, so a sorted run of queries (a cash flow schedule)
+// only ever steps the cursor forward and costs O(1) each
+class ZeroCurve {
+public:
+	ZeroCurve(const std::vector<DepositQuote>& deposits, const std::vector<BondQuote>& bonds);
+
+	double discountFactor(double t) const;
+	double zeroRate(double t) const;  // continuously compounded
+	void discountFactors(const double* times, double* factors, std::size_t n) const;  // fastest when times are sorted
+	const std::vector<double>& tenors() const { return m_tenors; }
+
+private:
+	std::vector<double> m_tenors;         // pillar times, m_tenors[0] = 0
+	std::vector<double> m_logDiscounts;   // ln DF at each pillar, m_logDiscounts[0] = 0
+
+	double logDiscount(double t, std::size_t& cursor) const;  // cursor is the segment [m_tenors[cursor], m_tenors[cursor + 1]) to start from
+	void addBondPillar(const BondQuote& bond);
+};
+
+ZeroCurve::ZeroCurve(const std::vector<DepositQuote>& deposits, const std::vector<BondQuote>& bonds) : m_tenors{ 0 }, m_logDiscounts{ 0 }
+{
+	// instruments are assumed sorted by maturity, with every deposit shorter than every bond
+	for (const DepositQuote& deposit : deposits)
+	{
+		IntRateCalculator growth(deposit.rate * deposit.tenor);
+		m_tenors.push_back(deposit.tenor);
+		m_logDiscounts.push_back(-std::log(growth.singlePeriod(1.0)));
+	}
+	for (const BondQuote& bond : bonds)
+	{
+		addBondPillar(bond);
+	}
+}
+
+void ZeroCurve::addBondPillar(const BondQuote& bond)
+{
+	// coupon dates counted back from maturity, the known part of the price uses the curve built so far
+	double lastTenor = m_tenors.back();
+	double lastLog = m_logDiscounts.back();
+	double coupon = 100 * bond.coupon / bond.frequency;
+	double knownValue = 0;
+	std::vector<double> newTimes, newFlows;
+	for (int k = 0; ; ++k)
+	{
+		double t = bond.maturity - double(k) / bond.frequency;
+		if (t <= 1e-9) break;
+		double cashFlow = (k == 0) ? coupon + 100 : coupon;
+		if (t <= lastTenor) knownValue += cashFlow * discountFactor(t);
+		else
+		{
+			newTimes.push_back(t);
+			newFlows.push_back(cashFlow);
+		}
+	}
+
+	// x = ln DF(T), each unknown cash flow has ln DF(t) = (1 - w) lastLog + w x with w = (t - lastTenor) / (T - lastTenor)
+	double span = bond.maturity - lastTenor;
+	double x = lastTenor > 0 ? lastLog * bond.maturity / lastTenor : -0.03 * bond.maturity;  // start from a flat extrapolation
+	for (int i = 0; i < 50; ++i)
+	{
+		double value = knownValue, slope = 0;
+		for (std::size_t j = 0; j < newTimes.size(); ++j)
+		{
+			double w = (newTimes[j] - lastTenor) / span;
+			double pv = newFlows[j] * std::exp((1 - w) * lastLog + w * x);
+			value += pv;
+			slope += w * pv;
+		}
+		double step = (value - bond.price) / slope;
+		x -= step;
+		if (std::abs(step) < 1e-14) break;
+	}
+	m_tenors.push_back(bond.maturity);
+	m_logDiscounts.push_back(x);
+}
+
+double ZeroCurve::logDiscount(double t, std::size_t& cursor) const
+{
+	std::size_t last = m_tenors.size() - 1;
+	if (t <= 0 || last == 0) return 0;
+	if (t >= m_tenors[last]) return m_logDiscounts[last] * t / m_tenors[last];  // flat zero rate beyond the last pillar
+
+	if (cursor >= last || t < m_tenors[cursor])
+	{
+		// moved backwards (or no hint), fall back to a binary search to find the segment again
+		cursor = std::upper_bound(m_tenors.begin(), m_tenors.end(), t) - m_tenors.begin() - 1;
+	}
+	while (t >= m_tenors[cursor + 1])
+	{
+		++cursor;
+	}
+
+	double w = (t - m_tenors[cursor]) / (m_tenors[cursor + 1] - m_tenors[cursor]);
+	return (1 - w) * m_logDiscounts[cursor] + w * m_logDiscounts[cursor + 1];
+}
+
+double ZeroCurve::discountFactor(double t) const
+{
+	std::size_t cursor = m_tenors.size();  // no hint, binary search
+	return std::exp(logDiscount(t, cursor));
+}
+
+double ZeroCurve::zeroRate(double t) const
+{
+	std::size_t cursor = m_tenors.size();
+	return t > 0 ? -logDiscount(t, cursor) / t : 0;
+}
+
+void ZeroCurve::discountFactors(const double* times, double* factors, std::size_t n) const
+{
+	std::size_t cursor = 0;  // local to this call, so concurrent calls on one curve don't interfere
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		factors[i] = std::exp(logDiscount(times[i], cursor));
+	}
+}
+
 
 int main() {
 	std::cout << "hi!" << std::endl;
@@ -260,6 +699,27 @@ int main() {
 	std::cout << comp_1.multiplePeriod(compound_value, num_periods) << std::endl;
 	std::cout << comp_1.continousCompounding(compound_value, num_periods) << std::endl;
 
+	CashFlowCalculator cashFlow(0.05);
+	cashFlow.addCashPayment(500, 1);
+	cashFlow.addCashPayment(500, 2);
+	cashFlow.addCashPayment(10'500, 3);
+	YieldCurve curve({ 1, 3, 10 }, { 0.04, 0.05, 0.055 });
+	std::cout << "flat pv " << cashFlow.presentValue() << " curve pv " << cashFlow.presentValue(curve) << std::endl;
+	std::cout << "bulk pv " << presentValues({ { { 500, 500, 10'500 }, { 1, 2, 3 } } }, curve)[0] << std::endl;
+
+	BondCalculator bond("treasury", 10, 1'000, 25);  // 10 semi annual periods paying 25 on 1000
+	BondAnalytics risk = bond.analytics(980);
+	std::cout << "ytm per period " << risk.yield << " modified duration " << risk.modifiedDuration << " convexity " << risk.convexity
+		<< " in " << risk.iterations << " iterations" << std::endl;
+	benchmarkBondAnalytics(50'000);
+
+	ZeroCurve zeroCurve({ { 0.25, 0.030 }, { 0.5, 0.032 }, { 1.0, 0.034 } },
+		{ { 2.0, 0.035, 100.2, 2 }, { 5.0, 0.040, 101.0, 2 }, { 10.0, 0.045, 102.5, 2 } });
+	for (double t : zeroCurve.tenors())
+	{
+		std::cout << "tenor " << t << " zero rate " << zeroCurve.zeroRate(t) << " df " << zeroCurve.discountFactor(t) << std::endl;
+	}
+
 
 
 
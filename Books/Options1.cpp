@@ -1,5 +1,12 @@
 # include <iostream>
 # include <vector>
+# include <span>
+# include <thread>
+# include <chrono>
+# include <random>
+# include <algorithm>
+# include <cmath>
+# include <cassert>
 
 // create a class for a generic option to calculate the value of the option at expiration
 // constructors are called often and sometimes unintentionally so make them as lightweight as possible
@@ -7,9 +14,10 @@
 // frequently called for the creation of temporary objectsand used when passing
 // parameters by value, for example.Complex constructors can cause your code to run slowerand make classes harder to maintain.
 
+// the values double as a sign: a call pays max(+(S - K), 0) and a put pays max(-(S - K), 0), the same trick as Side in the HFT notes
 enum class OptionType {  // Optiontype best represented as an enum
-	OptionType_Call,
-	OptionType_Put
+	OptionType_Call = 1,
+	OptionType_Put = -1
 };
 
 class GenericOption {
@@ -19,8 +27,12 @@ public:
 	~GenericOption();
 	GenericOption& operator= (const GenericOption& p);
 
-	double valueAtExpiration(double underlyingAtExpiration);
-	double profitAtExpiration(double underlyingAtExpiration);
+	double valueAtExpiration(double underlyingAtExpiration) const;
+	double profitAtExpiration(double underlyingAtExpiration) const;  // for the holder, who paid m_cost for the option
+
+	double strike() const { return m_strike; }
+	double cost() const { return m_cost; }
+	OptionType type() const { return m_type; }
 
 private:
 	double m_strike;
@@ -56,27 +68,187 @@ GenericOption& GenericOption::operator= (const GenericOption& p)
 }
 
 // now compute the value of the option at expiration date
+// multiplying by the sign instead of branching on the type keeps the calculation branch free,
+// the compiler turns the comparison into a max instruction, so calls and puts can be mixed freely in a loop
+
+double GenericOption::valueAtExpiration(double underlyingAtExpiration) const
+{
+	double sign = static_cast<double>(static_cast<int>(m_type));
+	double intrinsic = sign * (underlyingAtExpiration - m_strike);
+	return intrinsic > 0.0 ? intrinsic : 0.0;
+}
 
-double GenericOption::valueAtExpiration(double underlyingAtExpiration)
+double GenericOption::profitAtExpiration(double underlyingAtExpiration) const
 {
-	double value = 0.0;
-	if (m_type == OptionType::OptionType_Call)
+	return valueAtExpiration(underlyingAtExpiration) - m_cost;
+}
+
+// Portfolio payoff profiles
+// to see the payoff of a whole book across a range of prices at expiry, every option has to be valued at every grid point
+// calling valueAtExpiration on a vector of GenericOption objects works, but the fields of each option are interleaved in memory
+// and the loop runs one option at one price at a time
+// OptionPortfolio stores the book as a structure of arrays: one array of strikes, one of signs, one of quantities
+// the inner loop then runs over a block of grid points for a single option, which the compiler vectorises,
+// each block of the output stays in L1 cache while every option is added into it, and blocks are shared out between threads
+
+class OptionPortfolio {
+public:
+	void reserve(std::size_t numOptions);
+	void addOption(const GenericOption& option, double quantity);  // a negative quantity is a short position
+	std::size_t size() const { return m_strikes.size(); }
+	double premium() const { return m_premium; }  // net premium paid for the book, negative if it was collected
+
+	// values and profits must be the same length as underlyings
+	void valueAtExpiration(std::span<const double> underlyings, std::span<double> values, unsigned numThreads = 1) const;
+	void profitAtExpiration(std::span<const double> underlyings, std::span<double> profits, unsigned numThreads = 1) const;
+
+	static std::vector<double> priceGrid(double low, double high, std::size_t numPoints);
+
+private:
+	static constexpr std::size_t kGridBlock = 512;  // 4KB of output per block
+
+	std::vector<double> m_strikes;
+	std::vector<double> m_signs;  // +1 for calls, -1 for puts
+	std::vector<double> m_quantities;
+	double m_premium = 0.0;
+
+	void valueBlock(const double* underlyings, double* values, std::size_t count) const;
+};
+
+void OptionPortfolio::reserve(std::size_t numOptions)
+{
+	m_strikes.reserve(numOptions);
+	m_signs.reserve(numOptions);
+	m_quantities.reserve(numOptions);
+}
+
+void OptionPortfolio::addOption(const GenericOption& option, double quantity)
+{
+	m_strikes.push_back(option.strike());
+	m_signs.push_back(static_cast<double>(static_cast<int>(option.type())));
+	m_quantities.push_back(quantity);
+	m_premium += quantity * option.cost();
+}
+
+void OptionPortfolio::valueBlock(const double* underlyings, double* values, std::size_t count) const
+{
+	std::fill(values, values + count, 0.0);
+	for (std::size_t i = 0; i < m_strikes.size(); ++i)
 	{
-		if (m_strike < underlyingAtExpiration)
+		const double strike = m_strikes[i];
+		const double sign = m_signs[i];
+		const double quantity = m_quantities[i];
+		for (std::size_t j = 0; j < count; ++j)
 		{
-			value = underlyingAtExpiration - m_strike;
+			double intrinsic = sign * (underlyings[j] - strike);
+			values[j] += quantity * (intrinsic > 0.0 ? intrinsic : 0.0);
 		}
 	}
+}
+
+void OptionPortfolio::valueAtExpiration(std::span<const double> underlyings, std::span<double> values, unsigned numThreads) const
+{
+	// one output per grid point, a shorter output would be written past its end, so debug builds stop here and release builds do nothing
+	assert(values.size() == underlyings.size());
+	if (values.size() != underlyings.size()) return;
+
+	const std::size_t numBlocks = (underlyings.size() + kGridBlock - 1) / kGridBlock;
+	auto worker = [&](unsigned thread) {
+		for (std::size_t block = thread; block < numBlocks; block += numThreads)
+		{
+			std::size_t first = block * kGridBlock;
+			std::size_t count = std::min(kGridBlock, underlyings.size() - first);
+			valueBlock(underlyings.data() + first, values.data() + first, count);
+		}
+	};
 
-	else  // it's a put type
+	numThreads = std::max(1u, std::min<unsigned>(numThreads, static_cast<unsigned>(numBlocks)));
+	std::vector<std::thread> threads;
+	for (unsigned t = 1; t < numThreads; ++t)
 	{
-		if (m_strike > underlyingAtExpiration)
+		threads.emplace_back(worker, t);
+	}
+	worker(0);
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+}
+
+void OptionPortfolio::profitAtExpiration(std::span<const double> underlyings, std::span<double> profits, unsigned numThreads) const
+{
+	valueAtExpiration(underlyings, profits, numThreads);
+	if (profits.size() != underlyings.size()) return;
+	for (double& profit : profits)
+	{
+		profit -= m_premium;
+	}
+}
+
+std::vector<double> OptionPortfolio::priceGrid(double low, double high, std::size_t numPoints)
+{
+	std::vector<double> grid(numPoints, low);
+	double step = numPoints > 1 ? (high - low) / (numPoints - 1) : 0.0;
+	for (std::size_t i = 0; i < numPoints; ++i)
+	{
+		grid[i] = low + step * i;
+	}
+	return grid;
+}
+
+// compares the structure of arrays evaluator against valuing each GenericOption in turn
+void benchmarkPortfolioGrid(std::size_t numOptions, std::size_t numGridPoints)
+{
+	std::mt19937_64 rng(42);
+	std::uniform_real_distribution<double> strikes(50.0, 150.0);
+	std::uniform_real_distribution<double> quantities(-10.0, 10.0);
+	std::vector<GenericOption> options;
+	std::vector<double> positions;
+	options.reserve(numOptions);
+	OptionPortfolio book;
+	book.reserve(numOptions);
+	for (std::size_t i = 0; i < numOptions; ++i)
+	{
+		double strike = strikes(rng);
+		OptionType type = (rng() & 1) ? OptionType::OptionType_Call : OptionType::OptionType_Put;
+		options.emplace_back(strike, type, 0.05 * strike);
+		positions.push_back(std::round(quantities(rng)));
+		book.addOption(options.back(), positions.back());
+	}
+	std::vector<double> grid = OptionPortfolio::priceGrid(0.0, 200.0, numGridPoints);
+
+	// the object loop is slow, so it only values every 16th grid point, which is enough to check the results and time it
+	const std::size_t stride = 16;
+	auto start = std::chrono::steady_clock::now();
+	std::vector<double> reference(numGridPoints, 0.0);
+	for (std::size_t j = 0; j < numGridPoints; j += stride)
+	{
+		for (std::size_t i = 0; i < numOptions; ++i)
 		{
-			value = m_strike - underlyingAtExpiration;
+			reference[j] += positions[i] * options[i].profitAtExpiration(grid[j]);
 		}
 	}
+	double objectSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	double objectRate = double(numOptions) * ((numGridPoints + stride - 1) / stride) / objectSeconds / 1e9;
+	std::cout << numOptions << " options x " << numGridPoints << " prices, GenericOption loop: " << objectRate << " G payoffs/s" << std::endl;
 
-	return value;
+	unsigned hardware = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<double> profits(numGridPoints);
+	for (unsigned threads : { 1u, hardware })
+	{
+		start = std::chrono::steady_clock::now();
+		book.profitAtExpiration(grid, profits, threads);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		double maxError = 0.0;
+		for (std::size_t j = 0; j < numGridPoints; j += stride)
+		{
+			maxError = std::max(maxError, std::abs(profits[j] - reference[j]));
+		}
+		double rate = double(numOptions) * numGridPoints / seconds / 1e9;
+		std::cout << "  OptionPortfolio, " << threads << " threads: " << seconds << "s (" << rate << " G payoffs/s), speedup "
+			<< rate / objectRate << "x, max difference " << maxError << std::endl;
+		if (threads == hardware) break;
+	}
 }
 
 
@@ -86,4 +258,21 @@ int main() {
 	double value = option.valueAtExpiration(price1);
 
 	std::cout << "for 120 put for expiry at " << price1 << " is " << value;
+	std::cout << ", profit " << option.profitAtExpiration(price1) << std::endl;
+
+	// a long straddle with a short call on top
+	OptionPortfolio book;
+	book.addOption(GenericOption(100.0, OptionType::OptionType_Call, 4.0), 1.0);
+	book.addOption(GenericOption(100.0, OptionType::OptionType_Put, 3.5), 1.0);
+	book.addOption(GenericOption(110.0, OptionType::OptionType_Call, 1.2), -1.0);
+	std::vector<double> grid = OptionPortfolio::priceGrid(80.0, 120.0, 9);
+	std::vector<double> profits(grid.size());
+	book.profitAtExpiration(grid, profits);
+	for (std::size_t i = 0; i < grid.size(); ++i)
+	{
+		std::cout << grid[i] << ": " << profits[i] << std::endl;
+	}
+
+	benchmarkPortfolioGrid(100'000, 10'000);
+	return 0;
 }
\ No newline at end of file